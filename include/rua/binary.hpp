@@ -3,5 +3,7 @@
 
 #include "binary/bits.hpp"
 #include "binary/bytes.hpp"
+#include "binary/parallel_find.hpp"
+#include "binary/pattern_set.hpp"
 
 #endif
@@ -2,6 +2,7 @@
 #define _rua_binary_bits_hpp
 
 #include "../dype/any_ptr.hpp"
+#include "../hard/x86.hpp"
 #include "../util.hpp"
 
 #ifdef __cpp_lib_bitops
@@ -11,6 +12,12 @@
 #include <cstdio>
 #include <cstring>
 
+#if defined(RUA_X86) &&                                                        \
+	(defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define RUA_BITS_SIMD
+#include <immintrin.h>
+#endif
+
 namespace rua {
 
 // bit_as from any_ptr
@@ -165,9 +172,16 @@ bit_cast(const From &src) {
 	return bit_get<To>(&src);
 }
 
-// bit_equal
+/*
+	The comparisons below are vectorized when the CPU supports it, a size
+	that is not a multiple of the vector is finished by a last vector that
+	overlaps the previous one, so neither the heads nor the tails are
+	compared byte by byte.
 
-inline bool bit_equal(const uchar *a, const uchar *b, size_t size) {
+	Below the size of a vector, the comparisons are done word by word.
+*/
+
+inline bool _bit_equal_generic(const uchar *a, const uchar *b, size_t size) {
 	size_t i = 0;
 	if (size >= sizeof(uintptr_t)) {
 		for (;;) {
@@ -188,14 +202,8 @@ inline bool bit_equal(const uchar *a, const uchar *b, size_t size) {
 	return true;
 }
 
-inline bool bit_equal(any_ptr a, any_ptr b, size_t size) {
-	return bit_equal(a.as<const uchar *>(), b.as<const uchar *>(), size);
-}
-
-// bit_and_equal
-
-inline bool
-bit_and_equal(const uchar *a, const uchar *b, const uchar *mask, size_t size) {
+inline bool _bit_and_equal_generic(
+	const uchar *a, const uchar *b, const uchar *mask, size_t size) {
 	size_t i = 0;
 	if (size >= sizeof(uintptr_t)) {
 		for (;;) {
@@ -218,17 +226,7 @@ bit_and_equal(const uchar *a, const uchar *b, const uchar *mask, size_t size) {
 	return true;
 }
 
-inline bool bit_and_equal(any_ptr a, any_ptr b, any_ptr mask, size_t size) {
-	return bit_and_equal(
-		a.as<const uchar *>(),
-		b.as<const uchar *>(),
-		mask.as<const uchar *>(),
-		size);
-}
-
-// bit_contains
-
-inline bool bit_contains(
+inline bool _bit_contains_generic(
 	const uchar *masked,
 	const uchar *unmasked,
 	const uchar *mask,
@@ -255,6 +253,177 @@ inline bool bit_contains(
 	return true;
 }
 
+#ifdef RUA_BITS_SIMD
+
+inline RUA_TARGET_SSE2 __m128i _bit_load_sse2(const uchar *ptr) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+}
+
+inline RUA_TARGET_AVX2 __m256i _bit_load_avx2(const uchar *ptr) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+}
+
+// The differences of the vectors at an offset, which are all zero when the
+// vectors are considered equal.
+
+struct _bit_equal_diff {
+	const uchar *a, *b;
+
+	RUA_TARGET_SSE2 __m128i sse2(size_t i) const {
+		return _mm_xor_si128(_bit_load_sse2(a + i), _bit_load_sse2(b + i));
+	}
+
+	RUA_TARGET_AVX2 __m256i avx2(size_t i) const {
+		return _mm256_xor_si256(_bit_load_avx2(a + i), _bit_load_avx2(b + i));
+	}
+};
+
+struct _bit_and_equal_diff {
+	const uchar *a, *b, *mask;
+
+	RUA_TARGET_SSE2 __m128i sse2(size_t i) const {
+		return _mm_and_si128(
+			_mm_xor_si128(_bit_load_sse2(a + i), _bit_load_sse2(b + i)),
+			_bit_load_sse2(mask + i));
+	}
+
+	RUA_TARGET_AVX2 __m256i avx2(size_t i) const {
+		return _mm256_and_si256(
+			_mm256_xor_si256(_bit_load_avx2(a + i), _bit_load_avx2(b + i)),
+			_bit_load_avx2(mask + i));
+	}
+};
+
+struct _bit_contains_diff {
+	const uchar *masked, *unmasked, *mask;
+
+	RUA_TARGET_SSE2 __m128i sse2(size_t i) const {
+		return _mm_xor_si128(
+			_mm_and_si128(
+				_bit_load_sse2(unmasked + i), _bit_load_sse2(mask + i)),
+			_bit_load_sse2(masked + i));
+	}
+
+	RUA_TARGET_AVX2 __m256i avx2(size_t i) const {
+		return _mm256_xor_si256(
+			_mm256_and_si256(
+				_bit_load_avx2(unmasked + i), _bit_load_avx2(mask + i)),
+			_bit_load_avx2(masked + i));
+	}
+};
+
+inline RUA_TARGET_SSE2 bool _bit_is_zero_sse2(__m128i diff) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) ==
+		   0xFFFF;
+}
+
+// size must be at least 16.
+template <typename Diff>
+inline RUA_TARGET_SSE2 bool _bit_is_zero_sse2(const Diff &diff, size_t size) {
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		if (!_bit_is_zero_sse2(_mm_or_si128(
+				_mm_or_si128(diff.sse2(i), diff.sse2(i + 16)),
+				_mm_or_si128(diff.sse2(i + 32), diff.sse2(i + 48))))) {
+			return false;
+		}
+	}
+	for (; i + 16 <= size; i += 16) {
+		if (!_bit_is_zero_sse2(diff.sse2(i))) {
+			return false;
+		}
+	}
+	return i == size || _bit_is_zero_sse2(diff.sse2(size - 16));
+}
+
+inline RUA_TARGET_AVX2 bool _bit_is_zero_avx2(__m256i diff) {
+	return _mm256_testz_si256(diff, diff);
+}
+
+// size must be at least 32.
+template <typename Diff>
+inline RUA_TARGET_AVX2 bool _bit_is_zero_avx2(const Diff &diff, size_t size) {
+	size_t i = 0;
+	for (; i + 128 <= size; i += 128) {
+		if (!_bit_is_zero_avx2(_mm256_or_si256(
+				_mm256_or_si256(diff.avx2(i), diff.avx2(i + 32)),
+				_mm256_or_si256(diff.avx2(i + 64), diff.avx2(i + 96))))) {
+			return false;
+		}
+	}
+	for (; i + 32 <= size; i += 32) {
+		if (!_bit_is_zero_avx2(diff.avx2(i))) {
+			return false;
+		}
+	}
+	return i == size || _bit_is_zero_avx2(diff.avx2(size - 32));
+}
+
+// size must be at least 16.
+template <typename Diff>
+inline bool _bit_is_zero_simd(const Diff &diff, size_t size) {
+	if (size >= 32 && x86::has_avx2()) {
+		return _bit_is_zero_avx2(diff, size);
+	}
+	if (x86::has_sse2()) {
+		return _bit_is_zero_sse2(diff, size);
+	}
+	return false;
+}
+
+#endif
+
+// bit_equal
+
+inline bool bit_equal(const uchar *a, const uchar *b, size_t size) {
+#ifdef RUA_BITS_SIMD
+	if (size >= 16 && x86::has_sse2()) {
+		return _bit_is_zero_simd(_bit_equal_diff{a, b}, size);
+	}
+#endif
+	return _bit_equal_generic(a, b, size);
+}
+
+inline bool bit_equal(any_ptr a, any_ptr b, size_t size) {
+	return bit_equal(a.as<const uchar *>(), b.as<const uchar *>(), size);
+}
+
+// bit_and_equal
+
+inline bool
+bit_and_equal(const uchar *a, const uchar *b, const uchar *mask, size_t size) {
+#ifdef RUA_BITS_SIMD
+	if (size >= 16 && x86::has_sse2()) {
+		return _bit_is_zero_simd(_bit_and_equal_diff{a, b, mask}, size);
+	}
+#endif
+	return _bit_and_equal_generic(a, b, mask, size);
+}
+
+inline bool bit_and_equal(any_ptr a, any_ptr b, any_ptr mask, size_t size) {
+	return bit_and_equal(
+		a.as<const uchar *>(),
+		b.as<const uchar *>(),
+		mask.as<const uchar *>(),
+		size);
+}
+
+// bit_contains
+
+inline bool bit_contains(
+	const uchar *masked,
+	const uchar *unmasked,
+	const uchar *mask,
+	size_t size) {
+#ifdef RUA_BITS_SIMD
+	if (size >= 16 && x86::has_sse2()) {
+		return _bit_is_zero_simd(
+			_bit_contains_diff{masked, unmasked, mask}, size);
+	}
+#endif
+	return _bit_contains_generic(masked, unmasked, mask, size);
+}
+
 inline bool
 bit_contains(any_ptr masked, any_ptr unmasked, any_ptr mask, size_t size) {
 	return bit_contains(
@@ -15,6 +15,7 @@
 */
 
 #include "bits.hpp"
+#include "find.hpp"
 
 #include "../optional.hpp"
 #include "../range.hpp"
@@ -26,6 +27,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -35,6 +37,7 @@ class bytes_view;
 class bytes_ref;
 class bytes;
 class bytes_pattern;
+class compiled_bytes_pattern;
 
 template <typename Bytes>
 class basic_bytes_finder;
@@ -124,11 +127,30 @@ public:
 	inline optional<size_t>
 	index_of(const bytes_pattern &, size_t start_pos = 0) const;
 
+	// A template, so that a braced list only converts to a bytes_pattern.
+	template <
+		typename CompiledPattern,
+		typename = enable_if_t<
+			std::is_same<CompiledPattern, compiled_bytes_pattern>::value>>
+	optional<size_t>
+	index_of(const CompiledPattern &pat, size_t start_pos = 0) const {
+		return pat.index_of(*$this(), start_pos);
+	}
+
 	inline const_bytes_finder find(bytes_pattern, size_t start_pos = 0) const;
 
 	inline optional<size_t>
 	last_index_of(const bytes_pattern &, size_t start_pos = nullpos) const;
 
+	template <
+		typename CompiledPattern,
+		typename = enable_if_t<
+			std::is_same<CompiledPattern, compiled_bytes_pattern>::value>>
+	optional<size_t>
+	last_index_of(const CompiledPattern &pat, size_t start_pos = nullpos) const {
+		return pat.last_index_of(*$this(), start_pos);
+	}
+
 	inline const_bytes_rfinder
 	rfind(bytes_pattern, size_t start_pos = nullpos) const;
 
@@ -877,122 +899,147 @@ private:
 	}
 };
 
-template <typename Span>
-inline optional<size_t> const_bytes_base<Span>::index_of(
-	const bytes_pattern &pat, size_t start_pos) const {
+/*
+	A bytes_pattern prepared once for searching many buffers, the finders
+	keep it across their iterations.
 
-	auto sz = $this()->size();
-	auto mb_sz = pat.size();
-	if (sz < mb_sz) {
-		return nullopt;
-	}
+	Without the vector scan, a pattern that has a long enough fully
+	specified run is searched with the skip tables of the run instead.
+*/
 
-	auto begin = $this()->data() + start_pos;
-	auto end = begin + $this()->size() - mb_sz;
-	auto mb_begin = pat.masked().data();
+class compiled_bytes_pattern {
+public:
+	compiled_bytes_pattern() : $anc{0, 0, 0, 0, false}, $run{0, 0} {}
 
-	auto m_begin = pat.mask().data();
-	if (m_begin) {
-		for (auto it = begin; it != end; ++it) {
-			if (bit_contains(mb_begin, it, m_begin, mb_sz)) {
-				return it - begin;
-			}
+	explicit compiled_bytes_pattern(bytes_pattern pat) :
+		$pat(std::move(pat)),
+		$anc(_pick_bytes_anchors(
+			$pat.masked().data(), $pat.mask().data(), $pat.size())),
+		$run(_longest_bytes_run($pat.mask().data(), $pat.size())) {
+		if ($run.size >= 32 && !_has_bytes_scan_simd()) {
+			$tab = std::make_shared<_bytes_skip_table>(
+				$pat.masked().data() + $run.off, $run.size);
 		}
-		return nullopt;
 	}
 
-	if (sz == mb_sz) {
-		if (bit_equal(begin, mb_begin, sz)) {
-			return 0;
-		}
-		return nullopt;
+	const bytes_pattern &pattern() const {
+		return $pat;
 	}
 
-	size_t h = 0;
-	size_t mb_h = 0;
-	for (size_t i = 0; i < mb_sz; ++i) {
-		mb_h += mb_begin[i];
+	size_t size() const {
+		return $pat.size();
 	}
 
-	auto mb_back_ix = mb_sz - 1;
-	for (auto it = begin; it != end; ++it) {
-		if (it == begin) {
-			for (size_t j = 0; j < mb_sz; ++j) {
-				h += it[j];
-			}
-		} else {
-			h -= it[-1];
-			h += it[mb_back_ix];
+	optional<size_t> index_of(bytes_view place, size_t start_pos = 0) const {
+		auto sz = place.size();
+		if (start_pos > sz || sz - start_pos < size()) {
+			return nullopt;
 		}
-		if (h != mb_h) {
-			continue;
-		}
-		if (bit_equal(it, mb_begin, mb_sz)) {
-			return it - begin;
+		auto data = place.data() + start_pos;
+		auto n_pos = sz - start_pos - size() + 1;
+		auto pos = $tab ? _bytes_horspool_scan(
+							  data,
+							  n_pos,
+							  $pat.masked().data() + $run.off,
+							  $run,
+							  *$tab,
+							  $verifier())
+						: _bytes_scan(data, n_pos, $anc, $verifier());
+		if (pos == nullpos) {
+			return nullopt;
 		}
+		return start_pos + pos;
 	}
-	return nullopt;
-}
 
-template <typename Span>
-inline optional<size_t> const_bytes_base<Span>::last_index_of(
-	const bytes_pattern &pat, size_t start_pos) const {
-
-	auto sz = $this()->size();
-	auto mb_sz = pat.size();
-	if (sz < mb_sz) {
-		return nullopt;
+	// The match ends before start_pos.
+	optional<size_t>
+	last_index_of(bytes_view place, size_t start_pos = nullpos) const {
+		if (start_pos > place.size()) {
+			start_pos = place.size();
+		}
+		if (start_pos < size()) {
+			return nullopt;
+		}
+		auto data = place.data();
+		auto n_pos = start_pos - size() + 1;
+		auto pos = $tab ? _bytes_horspool_rscan(
+							  data,
+							  n_pos,
+							  $pat.masked().data() + $run.off,
+							  $run,
+							  *$tab,
+							  $verifier())
+						: _bytes_rscan(data, n_pos, $anc, $verifier());
+		if (pos == nullpos) {
+			return nullopt;
+		}
+		return pos;
 	}
 
-	if (start_pos >= sz) {
-		start_pos = sz;
-	}
+private:
+	bytes_pattern $pat;
+	_bytes_anchors $anc;
+	_bytes_run $run;
+	std::shared_ptr<const _bytes_skip_table> $tab;
 
-	auto begin = $this()->data();
-	auto begin_before = begin - 1;
-	auto end = $this()->data() + start_pos - mb_sz;
-	auto mb_begin = pat.masked().data();
+	struct $verifier_t {
+		const bytes_pattern *pat;
 
-	auto m_begin = pat.mask().data();
-	if (m_begin) {
-		for (auto it = end; it != begin_before; --it) {
-			if (bit_contains(mb_begin, it, m_begin, mb_sz)) {
-				return it - begin;
+		bool operator()(const uchar *it) const {
+			auto mask = pat->mask().data();
+			if (!mask) {
+				return bit_equal(it, pat->masked().data(), pat->size());
 			}
+			return bit_contains(pat->masked().data(), it, mask, pat->size());
 		}
+	};
+
+	$verifier_t $verifier() const {
+		return $verifier_t{&$pat};
+	}
+};
+
+template <typename Span>
+inline optional<size_t> const_bytes_base<Span>::index_of(
+	const bytes_pattern &pat, size_t start_pos) const {
+
+	auto sz = $this()->size();
+	if (start_pos > sz) {
 		return nullopt;
 	}
 
-	if (sz == mb_sz) {
-		if (bit_equal(end, mb_begin, sz)) {
-			return 0;
-		}
+	auto pos = _bytes_find(
+		$this()->data() + start_pos,
+		sz - start_pos,
+		pat.masked().data(),
+		pat.mask().data(),
+		pat.size());
+	if (pos == nullpos) {
 		return nullopt;
 	}
+	return start_pos + pos;
+}
 
-	size_t h = 0;
-	size_t mb_h = 0;
-	for (size_t i = 0; i < mb_sz; ++i) {
-		mb_h += mb_begin[i];
+template <typename Span>
+inline optional<size_t> const_bytes_base<Span>::last_index_of(
+	const bytes_pattern &pat, size_t start_pos) const {
+
+	auto sz = $this()->size();
+	if (start_pos > sz) {
+		start_pos = sz;
 	}
 
-	for (auto it = end; it != begin_before; --it) {
-		if (it == end) {
-			for (size_t j = 0; j < mb_sz; ++j) {
-				h += it[j];
-			}
-		} else {
-			h -= it[mb_sz];
-			h += it[0];
-		}
-		if (h != mb_h) {
-			continue;
-		}
-		if (bit_equal(it, mb_begin, mb_sz)) {
-			return it - begin;
-		}
+	// The match ends before start_pos.
+	auto pos = _bytes_rfind(
+		$this()->data(),
+		start_pos,
+		pat.masked().data(),
+		pat.mask().data(),
+		pat.size());
+	if (pos == nullpos) {
+		return nullopt;
 	}
-	return nullopt;
+	return pos;
 }
 
 template <typename Bytes>
@@ -1004,26 +1051,52 @@ public:
 
 	static basic_bytes_finder find(
 		Bytes place,
-		bytes_pattern pat,
+		compiled_bytes_pattern pat,
 		std::vector<sub_area_t> vas,
 		size_t start_pos = 0) {
-		auto pos_opt = place.index_of(pat, start_pos);
+		auto pos_opt = pat.index_of(place, start_pos);
 		if (!pos_opt) {
 			return basic_bytes_finder();
 		}
-		return basic_bytes_finder(place, pat, std::move(vas), *pos_opt);
+		return basic_bytes_finder(
+			place, std::move(pat), std::move(vas), *pos_opt);
 	}
 
-	static basic_bytes_finder rfind(
+	static basic_bytes_finder find(
 		Bytes place,
 		bytes_pattern pat,
 		std::vector<sub_area_t> vas,
+		size_t start_pos = 0) {
+		return find(
+			place,
+			compiled_bytes_pattern(std::move(pat)),
+			std::move(vas),
+			start_pos);
+	}
+
+	static basic_bytes_finder rfind(
+		Bytes place,
+		compiled_bytes_pattern pat,
+		std::vector<sub_area_t> vas,
 		size_t start_pos = nullpos) {
-		auto pos_opt = place.last_index_of(pat, start_pos);
+		auto pos_opt = pat.last_index_of(place, start_pos);
 		if (!pos_opt) {
 			return basic_bytes_finder();
 		}
-		return basic_bytes_finder(place, pat, std::move(vas), *pos_opt);
+		return basic_bytes_finder(
+			place, std::move(pat), std::move(vas), *pos_opt);
+	}
+
+	static basic_bytes_finder rfind(
+		Bytes place,
+		bytes_pattern pat,
+		std::vector<sub_area_t> vas,
+		size_t start_pos = nullpos) {
+		return rfind(
+			place,
+			compiled_bytes_pattern(std::move(pat)),
+			std::move(vas),
+			start_pos);
 	}
 
 	basic_bytes_finder() = default;
@@ -1060,7 +1133,10 @@ public:
 
 	basic_bytes_finder &operator++() {
 		return *this = basic_bytes_finder::find(
-				   $place, std::move($pat), std::move($vas), pos());
+				   $place,
+				   std::move($pat),
+				   std::move($vas),
+				   pos() + $found.size());
 	}
 
 	basic_bytes_finder operator++(int) {
@@ -1103,12 +1179,12 @@ public:
 
 private:
 	Bytes $place, $found;
-	bytes_pattern $pat;
+	compiled_bytes_pattern $pat;
 	std::vector<sub_area_t> $vas;
 
 	basic_bytes_finder(
 		Bytes place,
-		bytes_pattern pat,
+		compiled_bytes_pattern pat,
 		std::vector<sub_area_t> vas,
 		size_t found_pos) :
 		$place(place),
@@ -1116,7 +1192,7 @@ private:
 		$pat(std::move(pat)),
 		$vas(std::move(vas)) {
 
-		auto mask = $pat.mask();
+		auto mask = $pat.pattern().mask();
 		if (!mask || $vas.size()) {
 			return;
 		}
@@ -0,0 +1,496 @@
+#ifndef _rua_binary_find_hpp
+#define _rua_binary_find_hpp
+
+#include "bits.hpp"
+
+#include "../hard/x86.hpp"
+#include "../util.hpp"
+
+#include <cstring>
+
+#if defined(RUA_X86) &&                                                        \
+	(defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define RUA_BYTES_FIND_SIMD
+#include <immintrin.h>
+#endif
+
+namespace rua {
+
+/*
+	Reference from
+		http://0x80.pl/articles/simd-strfind.html
+
+	The search compares two anchor bytes of the pattern at once against a
+	whole vector of candidate positions, and only verifies the whole pattern
+	at the positions where both of them match.
+
+	The anchors are the rarest fully specified bytes of the pattern, ranked by
+	how often a byte is seen in common binaries and text. Wildcards and
+	partially masked bytes are never anchors.
+*/
+
+inline RUA_CONSTEXPR_14 int _byte_rank(uchar b) {
+	// Fillers.
+	if (b == 0x00 || b == 0xFF) {
+		return 250;
+	}
+	if (b == ' ' || b == 'e' || b == 't' || b == 'a' || b == 'o' ||
+		b == 'i' || b == 'n' || b == 's' || b == 'r') {
+		return 200;
+	}
+	if (b >= 'a' && b <= 'z') {
+		return 170;
+	}
+	if (b >= '0' && b <= '9') {
+		return 150;
+	}
+	if (b >= 'A' && b <= 'Z') {
+		return 140;
+	}
+	if (b == '\n' || b == '\r' || b == '\t' || (b > ' ' && b < 0x7F)) {
+		return 120;
+	}
+	// Small integers and the common opcodes.
+	if (b < 0x10 || b == 0x89 || b == 0x8B || b == 0xCC || b == 0xE8) {
+		return 110;
+	}
+	if (b < 0x20) {
+		return 60;
+	}
+	return 50;
+}
+
+struct _bytes_anchors {
+	size_t off1, off2;
+	uchar b1, b2;
+	bool has;
+};
+
+inline _bytes_anchors
+_pick_bytes_anchors(const uchar *masked, const uchar *mask, size_t size) {
+	_bytes_anchors anc{0, 0, 0, 0, false};
+	int rank1 = 256, rank2 = 256;
+	for (size_t i = 0; i < size; ++i) {
+		if (mask && mask[i] != 0xFF) {
+			continue;
+		}
+		auto rank = _byte_rank(masked[i]);
+		if (rank < rank1) {
+			if (anc.has) {
+				anc.off2 = anc.off1;
+				anc.b2 = anc.b1;
+				rank2 = rank1;
+			}
+			anc.off1 = i;
+			anc.b1 = masked[i];
+			rank1 = rank;
+			anc.has = true;
+		} else if (rank < rank2) {
+			anc.off2 = i;
+			anc.b2 = masked[i];
+			rank2 = rank;
+		}
+	}
+	if (anc.has && rank2 == 256) {
+		anc.off2 = anc.off1;
+		anc.b2 = anc.b1;
+	}
+	return anc;
+}
+
+inline int _bytes_find_ctz(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long ix;
+	_BitScanForward(&ix, bits);
+	return static_cast<int>(ix);
+#elif defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(bits);
+#else
+	return countr_zero(bits);
+#endif
+}
+
+inline int _bytes_find_msb(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long ix;
+	_BitScanReverse(&ix, bits);
+	return static_cast<int>(ix);
+#elif defined(__GNUC__) || defined(__clang__)
+	return 31 - __builtin_clz(bits);
+#else
+	return 31 - countl_zero(bits);
+#endif
+}
+
+// The scans below look for the first (or the last) of the n_pos candidate
+// positions where verify(data + pos) holds, returning nullpos if none.
+
+template <typename Verify>
+inline size_t _bytes_scan_generic(
+	const uchar *data,
+	size_t first_pos,
+	size_t n_pos,
+	const _bytes_anchors &anc,
+	Verify &verify) {
+	if (!anc.has) {
+		for (auto p = first_pos; p < n_pos; ++p) {
+			if (verify(data + p)) {
+				return p;
+			}
+		}
+		return nullpos;
+	}
+	auto p = first_pos;
+	while (p < n_pos) {
+		auto hit = memchr(data + p + anc.off1, anc.b1, n_pos - p);
+		if (!hit) {
+			return nullpos;
+		}
+		p = static_cast<size_t>(static_cast<const uchar *>(hit) - data) -
+			anc.off1;
+		if (data[p + anc.off2] == anc.b2 && verify(data + p)) {
+			return p;
+		}
+		++p;
+	}
+	return nullpos;
+}
+
+template <typename Verify>
+inline size_t _bytes_rscan_generic(
+	const uchar *data,
+	size_t end_pos,
+	const _bytes_anchors &anc,
+	Verify &verify) {
+	for (auto p = end_pos; p-- > 0;) {
+		if (anc.has &&
+			(data[p + anc.off1] != anc.b1 || data[p + anc.off2] != anc.b2)) {
+			continue;
+		}
+		if (verify(data + p)) {
+			return p;
+		}
+	}
+	return nullpos;
+}
+
+#ifdef RUA_BYTES_FIND_SIMD
+
+template <typename Verify>
+inline RUA_TARGET_SSE2 size_t _bytes_scan_sse2(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify &verify) {
+	auto v1 = _mm_set1_epi8(static_cast<char>(anc.b1));
+	auto v2 = _mm_set1_epi8(static_cast<char>(anc.b2));
+	size_t p = 0;
+	for (; p + 16 <= n_pos; p += 16) {
+		auto eq1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + p + anc.off1)),
+			v1);
+		auto eq2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + p + anc.off2)),
+			v2);
+		auto bits =
+			static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(eq1, eq2)));
+		while (bits) {
+			auto i = p + _bytes_find_ctz(bits);
+			if (verify(data + i)) {
+				return i;
+			}
+			bits &= bits - 1;
+		}
+	}
+	return _bytes_scan_generic(data, p, n_pos, anc, verify);
+}
+
+template <typename Verify>
+inline RUA_TARGET_SSE2 size_t _bytes_rscan_sse2(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify &verify) {
+	auto v1 = _mm_set1_epi8(static_cast<char>(anc.b1));
+	auto v2 = _mm_set1_epi8(static_cast<char>(anc.b2));
+	auto p = n_pos;
+	while (p >= 16) {
+		p -= 16;
+		auto eq1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + p + anc.off1)),
+			v1);
+		auto eq2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(data + p + anc.off2)),
+			v2);
+		auto bits =
+			static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(eq1, eq2)));
+		while (bits) {
+			auto bit = _bytes_find_msb(bits);
+			if (verify(data + p + bit)) {
+				return p + bit;
+			}
+			bits &= ~(static_cast<uint32_t>(1) << bit);
+		}
+	}
+	return _bytes_rscan_generic(data, p, anc, verify);
+}
+
+template <typename Verify>
+inline RUA_TARGET_AVX2 size_t _bytes_scan_avx2(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify &verify) {
+	auto v1 = _mm256_set1_epi8(static_cast<char>(anc.b1));
+	auto v2 = _mm256_set1_epi8(static_cast<char>(anc.b2));
+	size_t p = 0;
+	for (; p + 32 <= n_pos; p += 32) {
+		auto eq1 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(data + p + anc.off1)),
+			v1);
+		auto eq2 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(data + p + anc.off2)),
+			v2);
+		auto bits = static_cast<uint32_t>(
+			_mm256_movemask_epi8(_mm256_and_si256(eq1, eq2)));
+		while (bits) {
+			auto i = p + _bytes_find_ctz(bits);
+			if (verify(data + i)) {
+				return i;
+			}
+			bits &= bits - 1;
+		}
+	}
+	return _bytes_scan_generic(data, p, n_pos, anc, verify);
+}
+
+template <typename Verify>
+inline RUA_TARGET_AVX2 size_t _bytes_rscan_avx2(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify &verify) {
+	auto v1 = _mm256_set1_epi8(static_cast<char>(anc.b1));
+	auto v2 = _mm256_set1_epi8(static_cast<char>(anc.b2));
+	auto p = n_pos;
+	while (p >= 32) {
+		p -= 32;
+		auto eq1 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(data + p + anc.off1)),
+			v1);
+		auto eq2 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(data + p + anc.off2)),
+			v2);
+		auto bits = static_cast<uint32_t>(
+			_mm256_movemask_epi8(_mm256_and_si256(eq1, eq2)));
+		while (bits) {
+			auto bit = _bytes_find_msb(bits);
+			if (verify(data + p + bit)) {
+				return p + bit;
+			}
+			bits &= ~(static_cast<uint32_t>(1) << bit);
+		}
+	}
+	return _bytes_rscan_generic(data, p, anc, verify);
+}
+
+#endif
+
+inline bool _has_bytes_scan_simd() {
+#ifdef RUA_BYTES_FIND_SIMD
+	return x86::has_sse2();
+#else
+	return false;
+#endif
+}
+
+template <typename Verify>
+inline size_t _bytes_scan(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify verify) {
+#ifdef RUA_BYTES_FIND_SIMD
+	if (anc.has) {
+		if (x86::has_avx2()) {
+			return _bytes_scan_avx2(data, n_pos, anc, verify);
+		}
+		if (x86::has_sse2()) {
+			return _bytes_scan_sse2(data, n_pos, anc, verify);
+		}
+	}
+#endif
+	return _bytes_scan_generic(data, 0, n_pos, anc, verify);
+}
+
+template <typename Verify>
+inline size_t _bytes_rscan(
+	const uchar *data, size_t n_pos, const _bytes_anchors &anc, Verify verify) {
+#ifdef RUA_BYTES_FIND_SIMD
+	if (anc.has) {
+		if (x86::has_avx2()) {
+			return _bytes_rscan_avx2(data, n_pos, anc, verify);
+		}
+		if (x86::has_sse2()) {
+			return _bytes_rscan_sse2(data, n_pos, anc, verify);
+		}
+	}
+#endif
+	return _bytes_rscan_generic(data, n_pos, anc, verify);
+}
+
+/*
+	Reference from
+		https://en.wikipedia.org/wiki/Boyer%E2%80%93Moore%E2%80%93Horspool_algorithm
+
+	A wildcard matches every byte, so it would cap the shifts of a skip table
+	built over the whole pattern at its distance to the end. The table is
+	built over the longest fully specified run instead, and the rest of the
+	pattern is only verified where the run matches.
+
+	It reads one byte per shift, so it is bound by the latency of the loads,
+	while the vector scan of the anchors is bound by the memory bandwidth.
+	The shifts only pay off against the scalar scan of the anchors, whose
+	memchr() stalls on the anchors that are common in the data.
+*/
+
+struct _bytes_run {
+	size_t off, size;
+};
+
+inline _bytes_run _longest_bytes_run(const uchar *mask, size_t size) {
+	if (!mask) {
+		return _bytes_run{0, size};
+	}
+	_bytes_run run{0, 0};
+	size_t i = 0;
+	while (i < size) {
+		if (mask[i] != 0xFF) {
+			++i;
+			continue;
+		}
+		auto begin = i;
+		while (i < size && mask[i] == 0xFF) {
+			++i;
+		}
+		if (i - begin > run.size) {
+			run.off = begin;
+			run.size = i - begin;
+		}
+	}
+	return run;
+}
+
+struct _bytes_skip_table {
+	// Shifts by the last byte of the window when searching forward, and by
+	// the first byte when searching backward.
+	uint32_t fwd[256], bwd[256];
+
+	_bytes_skip_table(const uchar *run, size_t size) {
+		auto sz = static_cast<uint32_t>(size);
+		for (auto &shift : fwd) {
+			shift = sz;
+		}
+		for (auto &shift : bwd) {
+			shift = sz;
+		}
+		for (uint32_t i = 0; i + 1 < sz; ++i) {
+			fwd[run[i]] = sz - 1 - i;
+		}
+		for (auto i = sz - 1; i > 0; --i) {
+			bwd[run[i]] = i;
+		}
+	}
+};
+
+template <typename Verify>
+inline size_t _bytes_horspool_scan(
+	const uchar *data,
+	size_t n_pos,
+	const uchar *run,
+	const _bytes_run &rg,
+	const _bytes_skip_table &tab,
+	Verify verify) {
+	auto back_ix = rg.size - 1;
+	auto back = run[back_ix];
+	auto last = data + rg.off + back_ix;
+	size_t p = 0;
+	while (p < n_pos) {
+		auto c = last[p];
+		if (c == back && bit_equal(data + p + rg.off, run, back_ix) &&
+			verify(data + p)) {
+			return p;
+		}
+		p += tab.fwd[c];
+	}
+	return nullpos;
+}
+
+template <typename Verify>
+inline size_t _bytes_horspool_rscan(
+	const uchar *data,
+	size_t n_pos,
+	const uchar *run,
+	const _bytes_run &rg,
+	const _bytes_skip_table &tab,
+	Verify verify) {
+	auto front = run[0];
+	auto first = data + rg.off;
+	auto p = n_pos;
+	while (p > 0) {
+		auto c = first[p - 1];
+		if (c == front &&
+			bit_equal(first + p, run + 1, rg.size - 1) &&
+			verify(data + p - 1)) {
+			return p - 1;
+		}
+		auto shift = tab.bwd[c];
+		if (p <= shift) {
+			break;
+		}
+		p -= shift;
+	}
+	return nullpos;
+}
+
+// Finds the first match of the pattern (masked & mask, mask may be null) in
+// data, returns nullpos if none.
+inline size_t _bytes_find(
+	const uchar *data,
+	size_t size,
+	const uchar *masked,
+	const uchar *mask,
+	size_t pat_size) {
+	if (size < pat_size) {
+		return nullpos;
+	}
+	auto anc = _pick_bytes_anchors(masked, mask, pat_size);
+	auto n_pos = size - pat_size + 1;
+	if (mask) {
+		return _bytes_scan(data, n_pos, anc, [=](const uchar *it) -> bool {
+			return bit_contains(masked, it, mask, pat_size);
+		});
+	}
+	return _bytes_scan(data, n_pos, anc, [=](const uchar *it) -> bool {
+		return bit_equal(it, masked, pat_size);
+	});
+}
+
+// Finds the last match of the pattern in data.
+inline size_t _bytes_rfind(
+	const uchar *data,
+	size_t size,
+	const uchar *masked,
+	const uchar *mask,
+	size_t pat_size) {
+	if (size < pat_size) {
+		return nullpos;
+	}
+	auto anc = _pick_bytes_anchors(masked, mask, pat_size);
+	auto n_pos = size - pat_size + 1;
+	if (mask) {
+		return _bytes_rscan(data, n_pos, anc, [=](const uchar *it) -> bool {
+			return bit_contains(masked, it, mask, pat_size);
+		});
+	}
+	return _bytes_rscan(data, n_pos, anc, [=](const uchar *it) -> bool {
+		return bit_equal(it, masked, pat_size);
+	});
+}
+
+} // namespace rua
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef _rua_binary_parallel_find_hpp
+#define _rua_binary_parallel_find_hpp
+
+#include "bytes.hpp"
+
+#include "../conc/future.hpp"
+#include "../conc/then.hpp"
+#include "../conc/when.hpp"
+#include "../optional.hpp"
+#include "../thread/executor.hpp"
+#include "../thread/parallel.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <type_traits>
+#include <memory>
+#include <vector>
+
+namespace rua {
+
+/*
+	Searches a large buffer on the default_executor(). The positions are
+	split into chunks, and each chunk is searched over its positions plus the
+	size of the pattern minus one bytes, so the matches across the chunks are
+	not missed.
+
+	The chunks are a few times more than the workers, a chunk that can not
+	beat a match already found is skipped.
+
+	When chunk_size is 0, it is chosen by the size of the buffer, and a
+	buffer that is not worth splitting is searched on the calling thread.
+
+	The buffer must be kept until the returned future is done.
+*/
+
+struct _parallel_find_chunks {
+	size_t n_pos, size, count;
+
+	_parallel_find_chunks(
+		size_t place_size, size_t pat_size, size_t chunk_size) :
+		n_pos(place_size >= pat_size ? place_size - pat_size + 1 : 0),
+		size(chunk_size) {
+		if (!pat_size) {
+			size = n_pos;
+		} else if (!size) {
+			size = n_pos / (default_executor().size() * 4);
+			if (size < 1024 * 1024) {
+				size = 1024 * 1024;
+			}
+		}
+		count = n_pos ? (n_pos - 1) / size + 1 : 0;
+	}
+
+	size_t begin(size_t ix) const {
+		return ix * size;
+	}
+
+	size_t end(size_t ix) const {
+		auto e = begin(ix) + size;
+		return e < n_pos ? e : n_pos;
+	}
+};
+
+// A template, so that a braced list only converts to a bytes_pattern.
+template <
+	typename CompiledPattern,
+	typename = enable_if_t<
+		std::is_same<CompiledPattern, compiled_bytes_pattern>::value>>
+inline future<optional<size_t>>
+parallel_index_of(
+	bytes_view place, CompiledPattern pat, size_t chunk_size = 0) {
+	_parallel_find_chunks chks(place.size(), pat.size(), chunk_size);
+	if (chks.count < 2) {
+		return pat.index_of(place);
+	}
+
+	struct ctx_t {
+		compiled_bytes_pattern pat;
+
+		// The first chunk that has a match.
+		std::atomic<size_t> found_ix;
+	};
+	std::shared_ptr<ctx_t> ctx(new ctx_t{std::move(pat), {nullpos}});
+
+	std::vector<future<optional<size_t>>> futs;
+	futs.reserve(chks.count);
+	for (size_t i = 0; i < chks.count; ++i) {
+		futs.emplace_back(
+			parallel([place, chks, ctx, i]() -> optional<size_t> {
+				if (ctx->found_ix.load() < i) {
+					return nullopt;
+				}
+				auto b = chks.begin(i);
+				auto pos_opt = ctx->pat.index_of(
+					place(b, chks.end(i) + ctx->pat.size() - 1));
+				if (!pos_opt) {
+					return nullopt;
+				}
+				auto found_ix = ctx->found_ix.load();
+				while (i < found_ix &&
+					   !ctx->found_ix.compare_exchange_weak(found_ix, i))
+					;
+				return b + *pos_opt;
+			}));
+	}
+	return when_all(std::move(futs)) >>
+		   [](std::vector<expected<optional<size_t>>> rets)
+			   -> optional<size_t> {
+		for (auto &ret : rets) {
+			if (ret && *ret) {
+				return **ret;
+			}
+		}
+		return nullopt;
+	};
+}
+
+inline future<optional<size_t>> parallel_index_of(
+	bytes_view place, bytes_pattern pat, size_t chunk_size = 0) {
+	return parallel_index_of(
+		place, compiled_bytes_pattern(std::move(pat)), chunk_size);
+}
+
+template <
+	typename CompiledPattern,
+	typename = enable_if_t<
+		std::is_same<CompiledPattern, compiled_bytes_pattern>::value>>
+inline future<optional<size_t>>
+parallel_last_index_of(
+	bytes_view place, CompiledPattern pat, size_t chunk_size = 0) {
+	_parallel_find_chunks chks(place.size(), pat.size(), chunk_size);
+	if (chks.count < 2) {
+		return pat.last_index_of(place);
+	}
+
+	struct ctx_t {
+		compiled_bytes_pattern pat;
+
+		// The last chunk that has a match plus one.
+		std::atomic<size_t> found_end;
+	};
+	std::shared_ptr<ctx_t> ctx(new ctx_t{std::move(pat), {0}});
+
+	std::vector<future<optional<size_t>>> futs;
+	futs.reserve(chks.count);
+
+	// Posts the last chunks first, they decide the result, so the results
+	// are also from the last chunk.
+	for (auto i = chks.count; i-- > 0;) {
+		futs.emplace_back(
+			parallel([place, chks, ctx, i]() -> optional<size_t> {
+				if (ctx->found_end.load() > i + 1) {
+					return nullopt;
+				}
+				auto b = chks.begin(i);
+				auto pos_opt = ctx->pat.last_index_of(
+					place(b, chks.end(i) + ctx->pat.size() - 1));
+				if (!pos_opt) {
+					return nullopt;
+				}
+				auto found_end = ctx->found_end.load();
+				while (
+					i + 1 > found_end &&
+					!ctx->found_end.compare_exchange_weak(found_end, i + 1))
+					;
+				return b + *pos_opt;
+			}));
+	}
+	return when_all(std::move(futs)) >>
+		   [](std::vector<expected<optional<size_t>>> rets)
+			   -> optional<size_t> {
+		for (auto &ret : rets) {
+			if (ret && *ret) {
+				return **ret;
+			}
+		}
+		return nullopt;
+	};
+}
+
+inline future<optional<size_t>> parallel_last_index_of(
+	bytes_view place, bytes_pattern pat, size_t chunk_size = 0) {
+	return parallel_last_index_of(
+		place, compiled_bytes_pattern(std::move(pat)), chunk_size);
+}
+
+// Every position of the matches in order, including the overlapped ones.
+template <
+	typename CompiledPattern,
+	typename = enable_if_t<
+		std::is_same<CompiledPattern, compiled_bytes_pattern>::value>>
+inline future<std::vector<size_t>>
+parallel_indexes_of(
+	bytes_view place, CompiledPattern pat, size_t chunk_size = 0) {
+	_parallel_find_chunks chks(place.size(), pat.size(), chunk_size);
+
+	auto find_chunk = [place, chks](
+						  const compiled_bytes_pattern &pat,
+						  size_t ix) -> std::vector<size_t> {
+		std::vector<size_t> poss;
+		auto b = chks.begin(ix);
+		auto chk = place(b, chks.end(ix) + pat.size() - 1);
+		for (auto pos_opt = pat.index_of(chk); pos_opt;
+			 pos_opt = pat.index_of(chk, *pos_opt + 1)) {
+			poss.emplace_back(b + *pos_opt);
+		}
+		return poss;
+	};
+
+	if (chks.count < 2) {
+		if (!chks.count) {
+			return std::vector<size_t>();
+		}
+		return find_chunk(pat, 0);
+	}
+
+	std::shared_ptr<const compiled_bytes_pattern> pat_ptr(
+		new compiled_bytes_pattern(std::move(pat)));
+
+	std::vector<future<std::vector<size_t>>> futs;
+	futs.reserve(chks.count);
+	for (size_t i = 0; i < chks.count; ++i) {
+		futs.emplace_back(parallel([find_chunk, pat_ptr, i]() {
+			return find_chunk(*pat_ptr, i);
+		}));
+	}
+	return when_all(std::move(futs)) >>
+		   [](std::vector<expected<std::vector<size_t>>> rets)
+			   -> std::vector<size_t> {
+		size_t n = 0;
+		for (auto &ret : rets) {
+			if (ret) {
+				n += ret->size();
+			}
+		}
+		std::vector<size_t> poss;
+		poss.reserve(n);
+		for (auto &ret : rets) {
+			if (ret) {
+				poss.insert(poss.end(), ret->begin(), ret->end());
+			}
+		}
+		return poss;
+	};
+}
+
+inline future<std::vector<size_t>> parallel_indexes_of(
+	bytes_view place, bytes_pattern pat, size_t chunk_size = 0) {
+	return parallel_indexes_of(
+		place, compiled_bytes_pattern(std::move(pat)), chunk_size);
+}
+
+} // namespace rua
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef _rua_binary_pattern_set_hpp
+#define _rua_binary_pattern_set_hpp
+
+#include "bytes.hpp"
+#include "find.hpp"
+
+#include "../util.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+namespace rua {
+
+/*
+	Matches many bytes_patterns in one pass over the data, reference from
+		https://en.wikipedia.org/wiki/Aho%E2%80%93Corasick_algorithm
+
+	A wildcard would branch the automaton, so only the longest fully
+	specified run of each pattern is put into it, and the whole pattern is
+	verified where its run is matched.
+
+	A pattern without any fully specified byte is verified at every offset,
+	an empty pattern is never reported.
+*/
+
+struct bytes_pattern_hit {
+	size_t id, offset;
+};
+
+class bytes_pattern_scanner;
+
+class bytes_pattern_set {
+public:
+	bytes_pattern_set() : bytes_pattern_set(std::vector<bytes_pattern>()) {}
+
+	// The id of a pattern is its index.
+	explicit bytes_pattern_set(std::vector<bytes_pattern> pats) :
+		$pats(std::move(pats)) {
+		$build();
+	}
+
+	bytes_pattern_set(std::initializer_list<bytes_pattern> pats) :
+		bytes_pattern_set(std::vector<bytes_pattern>(pats)) {}
+
+	size_t size() const {
+		return $pats.size();
+	}
+
+	const bytes_pattern &operator[](size_t id) const {
+		return $pats[id];
+	}
+
+	size_t max_size() const {
+		return $max_size;
+	}
+
+	// The hits are reported as their runs are passed, not in the order of
+	// their offsets.
+	template <typename Callback>
+	inline void scan(bytes_view place, Callback &&callback) const;
+
+	// Sorted by offset, then by id.
+	inline std::vector<bytes_pattern_hit> find_all(bytes_view place) const;
+
+private:
+	std::vector<bytes_pattern> $pats;
+	std::vector<_bytes_run> $runs;
+	std::vector<size_t> $blind_ids;
+	size_t $max_size;
+
+	// The bytes outside all runs share class 0.
+	uint16_t $cls[256];
+	size_t $n_cls;
+
+	// The transitions of a node are indexed by the classes.
+	std::vector<uint32_t> $delta;
+
+	struct $node_t {
+		// The node itself or the nearest suffix that ends a run, 0 if none.
+		uint32_t hit;
+
+		// The nearest proper suffix that ends a run, 0 if none.
+		uint32_t hit_next;
+
+		uint32_t out_begin, out_end;
+	};
+
+	std::vector<$node_t> $nodes;
+	std::vector<size_t> $out_ids;
+
+	void $build() {
+		$max_size = 0;
+		$runs.reserve($pats.size());
+		for (auto &pat : $pats) {
+			if (pat.size() > $max_size) {
+				$max_size = pat.size();
+			}
+			$runs.emplace_back(
+				_longest_bytes_run(pat.mask().data(), pat.size()));
+		}
+
+		for (auto &cls : $cls) {
+			cls = 0;
+		}
+		$n_cls = 1;
+		for (size_t id = 0; id < $pats.size(); ++id) {
+			auto &run = $runs[id];
+			auto run_data = $pats[id].masked().data() + run.off;
+			for (size_t i = 0; i < run.size; ++i) {
+				auto &cls = $cls[run_data[i]];
+				if (!cls) {
+					cls = static_cast<uint16_t>($n_cls++);
+				}
+			}
+		}
+
+		// Builds the trie of the runs.
+
+		const auto none = nmax<uint32_t>();
+		std::vector<std::vector<size_t>> own_ids(1);
+		$delta.assign($n_cls, none);
+
+		for (size_t id = 0; id < $pats.size(); ++id) {
+			auto &run = $runs[id];
+			if (!run.size) {
+				if ($pats[id].size()) {
+					$blind_ids.emplace_back(id);
+				}
+				continue;
+			}
+			auto run_data = $pats[id].masked().data() + run.off;
+			size_t s = 0;
+			for (size_t i = 0; i < run.size; ++i) {
+				auto ix = s * $n_cls + $cls[run_data[i]];
+				if ($delta[ix] == none) {
+					$delta[ix] = static_cast<uint32_t>(own_ids.size());
+					own_ids.emplace_back();
+					$delta.resize($delta.size() + $n_cls, none);
+				}
+				s = $delta[ix];
+			}
+			own_ids[s].emplace_back(id);
+		}
+
+		// Fills the missing transitions with the ones of the failure links in
+		// breadth-first order, so the scan never follows a failure link.
+
+		auto n_nodes = own_ids.size();
+		std::vector<uint32_t> fails(n_nodes, 0);
+		std::vector<uint32_t> order;
+		order.reserve(n_nodes);
+		order.emplace_back(0);
+
+		for (size_t k = 0; k < order.size(); ++k) {
+			auto u = order[k];
+			for (size_t c = 0; c < $n_cls; ++c) {
+				auto fail_next = u ? $delta[fails[u] * $n_cls + c] : 0;
+				auto &next = $delta[u * $n_cls + c];
+				if (next == none) {
+					next = fail_next;
+					continue;
+				}
+				fails[next] = fail_next;
+				order.emplace_back(next);
+			}
+		}
+
+		$nodes.resize(n_nodes);
+		for (auto u : order) {
+			auto &node = $nodes[u];
+			node.out_begin = static_cast<uint32_t>($out_ids.size());
+			auto &ids = own_ids[u];
+			$out_ids.insert($out_ids.end(), ids.begin(), ids.end());
+			node.out_end = static_cast<uint32_t>($out_ids.size());
+
+			auto fail_hit = u ? $nodes[fails[u]].hit : 0;
+			node.hit_next = fail_hit;
+			node.hit = ids.size() ? u : fail_hit;
+		}
+
+		// Turns the transitions into the offsets of the rows, with the hit
+		// flags of the nodes, so a step is a single load.
+		for (auto &next : $delta) {
+			auto is_hit = $nodes[next].hit != 0;
+			next = static_cast<uint32_t>(next * $n_cls);
+			if (is_hit) {
+				next |= $hit_flag;
+			}
+		}
+	}
+
+	static constexpr uint32_t $hit_flag = 0x80000000;
+
+	friend bytes_pattern_scanner;
+};
+
+// Scans a stream of chunks with a bytes_pattern_set, keeps the state of the
+// automaton and the tail of the stream across the chunks.
+class bytes_pattern_scanner {
+public:
+	bytes_pattern_scanner() : $set(nullptr), $state(0), $pos(0) {}
+
+	// The set must outlive the scanner.
+	explicit bytes_pattern_scanner(const bytes_pattern_set &set) :
+		$set(&set), $state(0), $pos(0) {}
+
+	// The size of the stream scanned.
+	size_t pos() const {
+		return $pos;
+	}
+
+	void reset() {
+		$state = 0;
+		$pos = 0;
+		$tail.clear();
+		$pendings.clear();
+	}
+
+	// The offsets are from the start of the stream, a hit that crosses the
+	// end of the chunk is reported when the chunks after it arrive.
+	template <typename Callback>
+	void scan(bytes_view chunk, Callback &&callback) {
+		assert($set);
+
+		auto &set = *$set;
+		auto data = chunk.data();
+		auto sz = chunk.size();
+		auto end_pos = $pos + sz;
+
+		if ($pendings.size()) {
+			size_t n_left = 0;
+			for (size_t i = 0; i < $pendings.size(); ++i) {
+				auto hit = $pendings[i];
+				if (hit.offset + set.$pats[hit.id].size() > end_pos) {
+					$pendings[n_left++] = hit;
+					continue;
+				}
+				if ($verify(hit, data)) {
+					callback(hit);
+				}
+			}
+			$pendings.resize(n_left);
+		}
+
+		auto delta = set.$delta.data();
+		auto cls = set.$cls;
+		auto has_blinds = set.$blind_ids.size() > 0;
+		auto s = $state;
+		for (size_t i = 0; i < sz; ++i) {
+			s = delta[(s & ~bytes_pattern_set::$hit_flag) + cls[data[i]]];
+			if (s & bytes_pattern_set::$hit_flag) {
+				auto u = (s & ~bytes_pattern_set::$hit_flag) / set.$n_cls;
+				auto run_end = $pos + i + 1;
+				for (auto t = set.$nodes[u].hit; t;
+					 t = set.$nodes[t].hit_next) {
+					auto &node = set.$nodes[t];
+					for (auto j = node.out_begin; j < node.out_end; ++j) {
+						$check(
+							set.$out_ids[j], run_end, data, end_pos, callback);
+					}
+				}
+			}
+			if (has_blinds) {
+				for (auto id : set.$blind_ids) {
+					$check(id, $pos + i, data, end_pos, callback);
+				}
+			}
+		}
+		$state = s;
+
+		// Keeps the bytes that a later hit may start from.
+		auto keep = set.$max_size ? set.$max_size - 1 : 0;
+		if (sz >= keep) {
+			$tail.assign(data + sz - keep, data + sz);
+		} else {
+			if ($tail.size() + sz > keep) {
+				$tail.erase(
+					$tail.begin(),
+					$tail.begin() + ($tail.size() + sz - keep));
+			}
+			$tail.insert($tail.end(), data, data + sz);
+		}
+		$pos = end_pos;
+	}
+
+private:
+	const bytes_pattern_set *$set;
+
+	// The offset of the row of the current node, with its hit flag.
+	uint32_t $state;
+	size_t $pos;
+	std::vector<uchar> $tail, $buf;
+	std::vector<bytes_pattern_hit> $pendings;
+
+	template <typename Callback>
+	void $check(
+		size_t id,
+		size_t run_end,
+		const uchar *data,
+		size_t end_pos,
+		Callback &callback) {
+		auto &run = $set->$runs[id];
+		auto run_back = run.off + run.size;
+		if (run_end < run_back) {
+			return;
+		}
+		bytes_pattern_hit hit{id, run_end - run_back};
+		if (hit.offset + $set->$pats[id].size() > end_pos) {
+			$pendings.emplace_back(hit);
+			return;
+		}
+		if ($verify(hit, data)) {
+			callback(hit);
+		}
+	}
+
+	// The hit must end in the chunk.
+	bool $verify(const bytes_pattern_hit &hit, const uchar *data) {
+		auto &pat = $set->$pats[hit.id];
+		if (hit.offset >= $pos) {
+			return pat.contains(
+				bytes_view(data + (hit.offset - $pos), pat.size()));
+		}
+
+		auto n_tail = $pos - hit.offset;
+		assert(n_tail <= $tail.size());
+
+		$buf.assign($tail.end() - n_tail, $tail.end());
+		$buf.insert($buf.end(), data, data + (pat.size() - n_tail));
+		return pat.contains(bytes_view($buf.data(), $buf.size()));
+	}
+};
+
+template <typename Callback>
+inline void
+bytes_pattern_set::scan(bytes_view place, Callback &&callback) const {
+	bytes_pattern_scanner scanner(*this);
+	scanner.scan(place, callback);
+}
+
+inline std::vector<bytes_pattern_hit>
+bytes_pattern_set::find_all(bytes_view place) const {
+	std::vector<bytes_pattern_hit> hits;
+	scan(place, [&hits](const bytes_pattern_hit &hit) {
+		hits.emplace_back(hit);
+	});
+	std::sort(
+		hits.begin(),
+		hits.end(),
+		[](const bytes_pattern_hit &a, const bytes_pattern_hit &b) {
+			return a.offset < b.offset || (a.offset == b.offset && a.id < b.id);
+		});
+	return hits;
+}
+
+} // namespace rua
+
+#endif
@@ -23,7 +23,7 @@
 #endif
 
 #define RUA_CODE_FN(ret, name, params, code)                                   \
-	static ret(*name) params = reinterpret_cast<ret(*) params>(                \
+	static ret(*const name) params = reinterpret_cast<ret(*) params>(          \
 		reinterpret_cast<uintptr_t>(&code[0]));
 
 #endif
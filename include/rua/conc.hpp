@@ -2,12 +2,18 @@
 #define _rua_conc_hpp
 
 #include "conc/await.hpp"
+#include "conc/bounded_chan.hpp"
 #include "conc/chan.hpp"
 #include "conc/future.hpp"
 #include "conc/mutex.hpp"
 #include "conc/once.hpp"
 #include "conc/promise.hpp"
+#include "conc/select.hpp"
+#include "conc/semaphore.hpp"
+#include "conc/shared_mutex.hpp"
 #include "conc/then.hpp"
+#include "conc/timer.hpp"
 #include "conc/wait.hpp"
+#include "conc/when.hpp"
 
 #endif
@@ -0,0 +1,232 @@
+#ifndef _rua_conc_bounded_chan_hpp
+#define _rua_conc_bounded_chan_hpp
+
+#include "future.hpp"
+#include "promise.hpp"
+
+#include "../optional.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <deque>
+
+namespace rua {
+
+/*
+	Unlike chan, the buffer of bounded_chan is a ring allocated once on
+	construction, so buffered values never cost a heap allocation.
+
+	When the ring is full, send() parks the value with the returned future,
+	which is fulfilled once a receiver frees up a slot.
+	Dropping that future does not cancel the send.
+*/
+
+template <typename T>
+class bounded_chan {
+public:
+	explicit bounded_chan(size_t capacity) :
+		$locked(false),
+		$ring(new $slot_t[capacity ? capacity : 1]),
+		$cap(capacity ? capacity : 1),
+		$head(0),
+		$sz(0) {}
+
+	bounded_chan(const bounded_chan &) = delete;
+
+	bounded_chan &operator=(const bounded_chan &) = delete;
+
+	~bounded_chan() {
+		while ($sz) {
+			$ring_pop_front();
+		}
+		delete[] $ring;
+
+		for (auto prm : $recv_wtrs) {
+			prm->unfulfill();
+		}
+		for (auto prm : $send_wtrs) {
+			prm->unfulfill();
+		}
+	}
+
+	size_t capacity() const {
+		return $cap;
+	}
+
+	template <
+		typename U,
+		typename = enable_if_t<std::is_constructible<T, U &&>::value>>
+	bool try_send(U &&val) {
+		$lock();
+		if ($recv_wtrs.size()) {
+			auto recv_wtr = $recv_wtrs.front();
+			$recv_wtrs.pop_front();
+			$unlock();
+			$send_wtr(recv_wtr, T(std::forward<U>(val)));
+			return true;
+		}
+		if ($sz == $cap) {
+			$unlock();
+			return false;
+		}
+		$ring_emplace_back(std::forward<U>(val));
+		$unlock();
+		return true;
+	}
+
+	future<> send(T val) {
+		$lock();
+		if ($recv_wtrs.size()) {
+			auto recv_wtr = $recv_wtrs.front();
+			$recv_wtrs.pop_front();
+			$unlock();
+			$send_wtr(recv_wtr, std::move(val));
+			return expected<>();
+		}
+		if ($sz < $cap) {
+			$ring_emplace_back(std::move(val));
+			$unlock();
+			return expected<>();
+		}
+		auto prm = new newable_promise<void, T>(std::move(val));
+		$send_wtrs.emplace_back(prm);
+		$unlock();
+		return future<>(*prm);
+	}
+
+	optional<T> try_recv() {
+		optional<T> r;
+		promise<void, T> *send_wtr = nullptr;
+
+		$lock();
+		if ($sz) {
+			r.emplace($ring_pop_front());
+			if ($send_wtrs.size()) {
+				send_wtr = $send_wtrs.front();
+				$send_wtrs.pop_front();
+				$ring_emplace_back(std::move(send_wtr->extend()));
+			}
+		} else if ($send_wtrs.size()) {
+			send_wtr = $send_wtrs.front();
+			$send_wtrs.pop_front();
+			r.emplace(std::move(send_wtr->extend()));
+		}
+		$unlock();
+
+		if (send_wtr) {
+			send_wtr->fulfill();
+		}
+		return r;
+	}
+
+	future<T> recv() {
+		auto val_opt = try_recv();
+		if (val_opt) {
+			return *std::move(val_opt);
+		}
+
+		auto prm = new newable_promise<T>;
+
+		$lock();
+		if (!$sz && $send_wtrs.empty()) {
+			$recv_wtrs.emplace_back(prm);
+			$unlock();
+			return future<T>(*prm);
+		}
+		$unlock();
+
+		prm->unuse();
+
+		return recv();
+	}
+
+private:
+	struct $slot_t {
+		alignas(alignof(T)) uchar sto[sizeof(T)];
+
+		T &value() {
+			return *reinterpret_cast<T *>(&sto[0]);
+		}
+	};
+
+	std::atomic<bool> $locked;
+	$slot_t *$ring;
+	size_t $cap, $head, $sz;
+	std::deque<promise<T> *> $recv_wtrs;
+	std::deque<promise<void, T> *> $send_wtrs;
+
+	void $lock() {
+		while ($locked.exchange(true, std::memory_order_acquire))
+			;
+	}
+
+	void $unlock() {
+		$locked.store(false, std::memory_order_release);
+	}
+
+	template <typename... Args>
+	void $ring_emplace_back(Args &&...args) {
+		assert($sz < $cap);
+
+		construct(
+			$ring[($head + $sz) % $cap].value(), std::forward<Args>(args)...);
+		++$sz;
+	}
+
+	template <typename... Args>
+	void $ring_emplace_front(Args &&...args) {
+		assert($sz < $cap);
+
+		$head = ($head + $cap - 1) % $cap;
+		construct($ring[$head].value(), std::forward<Args>(args)...);
+		++$sz;
+	}
+
+	T $ring_pop_front() {
+		assert($sz);
+
+		auto &val = $ring[$head].value();
+		T r(std::move(val));
+		destruct(val);
+		$head = ($head + 1) % $cap;
+		--$sz;
+		return r;
+	}
+
+	void $send_wtr(promise<T> *recv_wtr, T &&val) {
+		assert(recv_wtr);
+		recv_wtr->fulfill(std::move(val), [this](expected<T> exp) {
+			if (!exp) {
+				return;
+			}
+			$send_front(*std::move(exp));
+		});
+	}
+
+	// Returns a value that was handed to a receiver which gave up on it,
+	// ignoring the capacity limit so that it is never lost.
+	void $send_front(T val) {
+		$lock();
+		if ($recv_wtrs.size()) {
+			auto recv_wtr = $recv_wtrs.front();
+			$recv_wtrs.pop_front();
+			$unlock();
+			$send_wtr(recv_wtr, std::move(val));
+			return;
+		}
+		if ($sz < $cap) {
+			$ring_emplace_front(std::move(val));
+			$unlock();
+			return;
+		}
+		auto prm = new newable_promise<void, T>(std::move(val));
+		prm->unharvest();
+		$send_wtrs.emplace_front(prm);
+		$unlock();
+	}
+};
+
+} // namespace rua
+
+#endif
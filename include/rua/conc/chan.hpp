@@ -4,102 +4,303 @@
 #include "future.hpp"
 #include "promise.hpp"
 
-#include "../lockfree_list.hpp"
+#include "../lockfree_queue.hpp"
 #include "../optional.hpp"
+#include "../pool_allocator.hpp"
 #include "../time/tick.hpp"
 #include "../util.hpp"
 
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <type_traits>
 
 namespace rua {
 
+template <typename T>
+class chan;
+
+// A receiver that tells its chan when it is cancelled, so the chan drops it
+// early instead of keeping it queued until the next send.
+template <typename T>
+class chan_waiter : public promise<T> {
+public:
+	chan<T> *ch;
+
+	chan_waiter() : promise<T>(), ch(nullptr) {}
+
+	virtual ~chan_waiter() = default;
+
+	bool cancel() noexcept override {
+		// It may be dropped by the chan as soon as it is cancelled.
+		auto ch = this->ch;
+		if (!promise<T>::cancel()) {
+			return false;
+		}
+		if (ch) {
+			ch->$drop_cancelled();
+		}
+		return true;
+	}
+};
+
+template <typename T>
+class _newable_chan_waiter : public chan_waiter<T> {
+public:
+	_newable_chan_waiter() = default;
+
+	virtual ~_newable_chan_waiter() = default;
+
+	void on_destroy() noexcept override {
+		delete this;
+	}
+
+	static void *operator new(size_t size) {
+		if (size != sizeof(_newable_chan_waiter)) {
+			return ::operator new(size);
+		}
+		return pool_allocator<_newable_chan_waiter>().allocate(1);
+	}
+
+	static void operator delete(void *ptr, size_t size) {
+		if (size != sizeof(_newable_chan_waiter)) {
+			::operator delete(ptr);
+			return;
+		}
+		pool_allocator<_newable_chan_waiter>().deallocate(
+			reinterpret_cast<_newable_chan_waiter *>(ptr), 1);
+	}
+};
+
 template <typename T>
 class chan {
 public:
-	constexpr chan() : $buf(), $recv_wtrs() {}
+	constexpr chan() : $c(0), $buf(), $recv_wtrs() {}
 
 	chan(const chan &) = delete;
 
 	chan &operator=(const chan &) = delete;
 
 	bool send(T val) {
-		optional<promise<T> *> recv_wtr;
-		if ($buf.emplace_front_if_non_empty_or(
-				[this, &recv_wtr]() -> bool {
-					recv_wtr = $recv_wtrs.pop_back();
-					return !recv_wtr;
-				},
-				std::move(val))) {
+		// $c > 0 is the number of buffered values,
+		// $c < 0 is the number of waiting receivers.
+		if ($c++ >= 0) {
+			$buf.emplace_back(std::move(val));
 			return false;
 		}
-		$send_wtr(recv_wtr, std::move(val));
-		return true;
+		return $send_wtrs(std::move(val));
+	}
+
+	// Updates the counter once for the whole range, the values go to the
+	// waiting receivers first and the rest are buffered a block at a time.
+	// The values are copied unless the iterators are move iterators.
+	// Returns the number of values handed to receivers.
+	template <typename ForwardIt>
+	size_t send_many(ForwardIt first, ForwardIt last) {
+		auto n = std::distance(first, last);
+		if (n <= 0) {
+			return 0;
+		}
+		auto c = $c.fetch_add(n);
+		size_t wtr_n = c < 0 ? static_cast<size_t>(c < -n ? n : -c) : 0;
+
+		promise<T> *wtrs[$batch_sz];
+		for (size_t i = 0; i < wtr_n;) {
+			auto k = wtr_n - i;
+			if (k > $batch_sz) {
+				k = $batch_sz;
+			}
+			k = $pop_recv_wtrs(wtrs, k);
+			for (size_t j = 0; j < k; ++j) {
+				$send_wtr(wtrs[j], T(*first));
+				++first;
+			}
+			i += k;
+		}
+		$buf.push_back_many(first, last);
+		return wtr_n;
+	}
+
+	// Moves the values out of an rvalue range, copies them otherwise.
+	template <typename Range>
+	size_t send_many(Range &&vals) {
+		return $send_range(vals, std::is_lvalue_reference<Range>());
+	}
+
+	// Takes up to n buffered values without waiting, returns the number
+	// taken.
+	template <typename OutputIt>
+	size_t try_recv_many(OutputIt out, size_t n) {
+		auto c = $c.load();
+		ssize_t k;
+		do {
+			if (c <= 0) {
+				return 0;
+			}
+			k = c < static_cast<ssize_t>(n) ? c : static_cast<ssize_t>(n);
+		} while (!$c.compare_exchange_weak(c, c - k));
+
+		_lockfree_backoff bo;
+		size_t r = 0;
+		while (r < static_cast<size_t>(k)) {
+			auto popped = $buf.pop_front_many(out, k - r);
+			if (!popped) {
+				bo.snooze();
+				continue;
+			}
+			r += popped;
+		}
+		return r;
 	}
 
 	optional<T> try_recv() {
-		return
-#ifdef NDEBUG
-			$buf.pop_back();
-#else
-			$buf.pop_back_if_non_empty_and([this]() -> bool {
-				assert(!$recv_wtrs);
-				return !$recv_wtrs;
-			});
-#endif
+		auto c = $c.load();
+		do {
+			if (c <= 0) {
+				return nullopt;
+			}
+		} while (!$c.compare_exchange_weak(c, c - 1));
+		return $pop_buf();
 	}
 
 	future<T> recv() {
-		auto val_opt = try_recv();
-		if (val_opt) {
-			return *std::move(val_opt);
+		if ($c-- > 0) {
+			return *$pop_buf();
 		}
 
-		auto prm = new newable_promise<T>;
+		auto prm = new _newable_chan_waiter<T>;
+		prm->ch = this;
+		$recv_wtrs.emplace_back(prm);
+		return future<T>(static_cast<promise<T> &>(*prm));
+	}
+
+	// Receives into a promise owned by the caller, it may be fulfilled before
+	// returning. An unharvested value is sent again.
+	// A cancelled promise is skipped by the next send, a chan_waiter pointing
+	// to this chan is dropped as soon as it is cancelled.
+	void recv_to(promise<T> &wtr) {
+		if ($c-- > 0) {
+			$send_wtr(&wtr, *$pop_buf());
+			return;
+		}
+		$recv_wtrs.emplace_back(&wtr);
+	}
+
+private:
+	std::atomic<ssize_t> $c;
+	lockfree_queue<T, pool_allocator<T>> $buf;
+	lockfree_queue<promise<T> *, pool_allocator<promise<T> *>> $recv_wtrs;
+
+	// The counter is updated before the queue, so the value or the receiver
+	// may still be in flight for a short moment.
 
-		val_opt =
-			$buf.pop_back_or([this, prm]() { $recv_wtrs.emplace_front(prm); });
-		if (!val_opt) {
-			return future<T>(*prm);
+	optional<T> $pop_buf() {
+		_lockfree_backoff bo;
+		for (;;) {
+			auto val_opt = $buf.pop_front();
+			if (val_opt) {
+				return val_opt;
+			}
+			bo.snooze();
 		}
+	}
 
-		prm->unuse();
+	template <typename Range>
+	size_t $send_range(Range &vals, std::true_type) {
+		return send_many(std::begin(vals), std::end(vals));
+	}
 
-		return *std::move(val_opt);
+	template <typename Range>
+	size_t $send_range(Range &vals, std::false_type) {
+		return send_many(
+			std::make_move_iterator(std::begin(vals)),
+			std::make_move_iterator(std::end(vals)));
 	}
 
-private:
-	lockfree_list<T> $buf;
-	lockfree_list<promise<T> *> $recv_wtrs;
+	static constexpr size_t $batch_sz = 16;
+
+	// Returns at least one of them.
+	size_t $pop_recv_wtrs(promise<T> **wtrs, size_t n) {
+		_lockfree_backoff bo;
+		for (;;) {
+			auto k = $recv_wtrs.pop_front_many(wtrs, n);
+			if (k) {
+				return k;
+			}
+			bo.snooze();
+		}
+	}
 
-	void $send_wtr(optional<promise<T> *> &recv_wtr, T &&val) {
-		assert(recv_wtr);
-		assert(*recv_wtr);
-		(*recv_wtr)->fulfill(std::move(val), [this](expected<T> exp) {
+	promise<T> *$pop_recv_wtr() {
+		_lockfree_backoff bo;
+		for (;;) {
+			auto recv_wtr_opt = $recv_wtrs.pop_front();
+			if (recv_wtr_opt) {
+				assert(*recv_wtr_opt);
+				return *recv_wtr_opt;
+			}
+			bo.snooze();
+		}
+	}
+
+	move_only_function<void(expected<T>)> $resender() {
+		return [this](expected<T> exp) {
 			if (!exp) {
 				return;
 			}
-			$send_back(*std::move(exp));
-		});
-	}
-
-	bool $send_back(T val) {
-		optional<promise<T> *> recv_wtr;
-		if ($buf.emplace_back_if_non_empty_or(
-				[this, &recv_wtr]() -> bool {
-					recv_wtr = $recv_wtrs.pop_back();
-					return !recv_wtr;
-				},
-				std::move(val))) {
-			return false;
+			send(*std::move(exp));
+		};
+	}
+
+	// The counter is already taken for the first receiver, the cancelled
+	// receivers are skipped in a loop, each of them took a count of its own.
+	bool $send_wtrs(T &&val) {
+		expected<T> exp(std::move(val));
+		do {
+			if ($pop_recv_wtr()->try_fulfill(exp, $resender())) {
+				return true;
+			}
+		} while ($c++ < 0);
+		$buf.emplace_back(*std::move(exp));
+		return false;
+	}
+
+	void $send_wtr(promise<T> *recv_wtr, T &&val) {
+		expected<T> exp(std::move(val));
+		if (!recv_wtr->try_fulfill(exp, $resender())) {
+			send(*std::move(exp));
+		}
+	}
+
+	// Takes the waiting receivers like a sender until the first cancelled one
+	// is dropped, the live ones taken before it are queued again.
+	void $drop_cancelled() {
+		auto c = $c.load();
+		for (auto n = -c; n > 0; --n) {
+			do {
+				if (c >= 0) {
+					return;
+				}
+			} while (!$c.compare_exchange_weak(c, c + 1));
+
+			auto wtr = $pop_recv_wtr();
+			if (wtr->try_discard()) {
+				return;
+			}
+			recv_to(*wtr);
+			c = $c.load();
 		}
-		$send_wtr(recv_wtr, std::move(val));
-		return true;
 	}
+
+	friend chan_waiter<T>;
 };
 
+template <typename T>
+constexpr size_t chan<T>::$batch_sz;
+
 } // namespace rua
 
 #endif
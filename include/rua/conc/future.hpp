@@ -7,6 +7,7 @@
 #include "../coroutine.hpp"
 #include "../dype/variant.hpp"
 #include "../error.hpp"
+#include "../move_only.hpp"
 #include "../util.hpp"
 
 #include <atomic>
@@ -129,7 +130,7 @@ public:
 			   $v.template as<promise<PromiseValue> *>()->await_ready();
 	}
 
-	bool await_suspend(std::function<void()> notify) noexcept {
+	bool await_suspend(move_only_function<void()> notify) noexcept {
 		assert($v);
 		assert($v.template type_is<promise<PromiseValue> *>());
 
@@ -137,6 +138,16 @@ public:
 			std::move(notify));
 	}
 
+#ifdef __cpp_lib_coroutine
+	template <typename Promise>
+	bool await_suspend(coroutine_handle<Promise> co) noexcept {
+		assert($v);
+		assert($v.template type_is<promise<PromiseValue> *>());
+
+		return $v.template as<promise<PromiseValue> *>()->await_suspend(co);
+	}
+#endif
+
 	expected<T> await_resume() noexcept {
 		if (!$v) {
 			return err_unpromised;
@@ -149,6 +160,17 @@ public:
 		return std::move($v);
 	}
 
+	// Gives up a result that is not ready yet, the promise will not notify
+	// then. Returns false if the result is ready.
+	bool cancel() noexcept {
+		if (!$v || !$v.template type_is<promise<PromiseValue> *>() ||
+			!$v.template as<promise<PromiseValue> *>()->cancel()) {
+			return false;
+		}
+		$v.reset();
+		return true;
+	}
+
 	void reset() noexcept {
 		if (!$v) {
 			return;
@@ -4,7 +4,8 @@
 #include "future.hpp"
 #include "promise.hpp"
 
-#include "../lockfree_list.hpp"
+#include "../lockfree_queue.hpp"
+#include "../pool_allocator.hpp"
 #include "../util.hpp"
 
 #include <atomic>
@@ -42,16 +43,14 @@ public:
 				return;
 			}
 
-			assert($mtx->$c.load());
+			auto mtx = exchange($mtx, nullptr);
 
-			auto wtr_opt = $mtx->$wtrs.pop_back_if(
-				[this]() -> bool { return --$mtx->$c > 0; });
-			if (!wtr_opt) {
+			assert(mtx->$c.load());
+
+			if (--mtx->$c == 0) {
 				return;
 			}
-			(*wtr_opt)->fulfill(std::move(*this));
-
-			assert(!$mtx);
+			mtx->$pop_wtr()->fulfill(unlocker(*mtx));
 		}
 
 	private:
@@ -80,21 +79,28 @@ public:
 		}
 
 		auto prm = new newable_promise<unlocker>;
-
-		auto is_emplaced = $wtrs.emplace_front_if_non_empty_or(
-			[this]() -> bool { return $c.load() > 1; }, prm);
-		if (!is_emplaced) {
-			return future<unlocker>(*prm);
-		}
-
-		prm->unuse();
-
-		return unlocker(*this);
+		$wtrs.emplace_back(prm);
+		return future<unlocker>(*prm);
 	}
 
 private:
 	std::atomic<size_t> $c;
-	lockfree_list<promise<unlocker> *> $wtrs;
+	lockfree_queue<promise<unlocker> *, pool_allocator<promise<unlocker> *>>
+		$wtrs;
+
+	// The locker increases $c before it queues up, so it may still be in
+	// flight for a short moment.
+	promise<unlocker> *$pop_wtr() {
+		_lockfree_backoff bo;
+		for (;;) {
+			auto wtr_opt = $wtrs.pop_front();
+			if (wtr_opt) {
+				assert(*wtr_opt);
+				return *wtr_opt;
+			}
+			bo.snooze();
+		}
+	}
 
 	friend unlocker;
 };
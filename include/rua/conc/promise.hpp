@@ -3,7 +3,11 @@
 
 #include "await.hpp"
 
+#include "../coroutine.hpp"
+
 #include "../error.hpp"
+#include "../move_only.hpp"
+#include "../pool_allocator.hpp"
 #include "../util.hpp"
 
 #include <atomic>
@@ -52,39 +56,29 @@ public:
 
 	void fulfill(
 		expected<T> value = meet_expected,
-		std::function<void(expected<T>)> on_unharvested = nullptr) noexcept {
-
-		assert(std::is_void<T>::value || !$val);
-
-		$val = std::move(value);
-		$on_unharvested = std::move(on_unharvested);
-
-		auto old_state = $state.exchange(promise_state::fulfilled);
+		move_only_function<void(expected<T>)> on_unharvested = nullptr) noexcept {
 
-		assert(old_state != promise_state::fulfilled);
-
-		switch (old_state) {
-
-		case promise_state::harvested:
-			assert(
-				$state.exchange(promise_state::destroying) ==
-				promise_state::fulfilled);
-			if ($on_unharvested && $val) {
-				$on_unharvested(std::move($val));
-			}
-			on_destroy();
-			break;
-
-		case promise_state::has_notify: {
-			assert($notify);
-			auto notify = std::move($notify);
-			notify();
-			break;
+		if ($fulfill(std::move(value), std::move(on_unharvested))) {
+			return;
 		}
+		if ($on_unharvested && $val) {
+			$on_unharvested(std::move($val));
+		}
+		on_destroy();
+	}
 
-		default:
-			break;
+	// Unlike fulfill(), a cancelled promise leaves the value in place and is
+	// destroyed, so the caller can pass the value on without recursion.
+	bool try_fulfill(
+		expected<T> &value,
+		move_only_function<void(expected<T>)> on_unharvested = nullptr) noexcept {
+
+		if ($fulfill(std::move(value), std::move(on_unharvested))) {
+			return true;
 		}
+		value = std::move($val);
+		on_destroy();
+		return false;
 	}
 
 	void unfulfill() noexcept {
@@ -99,23 +93,19 @@ public:
 		return $state.load() == promise_state::fulfilled;
 	}
 
-	bool await_suspend(std::function<void()> notify) noexcept {
+	bool await_suspend(move_only_function<void()> notify) noexcept {
 		$notify = std::move(notify);
+		return $await_suspend();
+	}
 
-		auto old_state = $state.load();
-		if (old_state == promise_state::loss_notify) {
-			$state.compare_exchange_strong(
-				old_state, promise_state::has_notify);
-		}
-
-		assert(old_state != promise_state::has_notify);
-		assert(old_state != promise_state::harvested);
-		assert(
-			old_state == promise_state::loss_notify ||
-			old_state == promise_state::fulfilled);
-
-		return old_state != promise_state::fulfilled;
+#ifdef __cpp_lib_coroutine
+	// Resumes the coroutine in place, without a type-erased callback.
+	template <typename Promise>
+	bool await_suspend(coroutine_handle<Promise> co) noexcept {
+		$co = co;
+		return $await_suspend();
 	}
+#endif
 
 	expected<T> await_resume() noexcept {
 		expected<T> r;
@@ -137,22 +127,46 @@ public:
 	}
 
 	void unharvest() noexcept {
-		auto old_state = $state.exchange(promise_state::harvested);
-
-		assert(old_state != promise_state::harvested);
-
-		if (old_state != promise_state::fulfilled) {
+		if (cancel()) {
 			return;
 		}
 		assert(
 			$state.exchange(promise_state::destroying) ==
-			promise_state::harvested);
+			promise_state::fulfilled);
 		if ($on_unharvested && $val) {
 			$on_unharvested(std::move($val));
 		}
 		on_destroy();
 	}
 
+	// Gives up a promise that is not fulfilled yet, it will not notify then
+	// and the value fulfilled later goes to on_unharvested.
+	// Returns false if it has been fulfilled or harvested.
+	virtual bool cancel() noexcept {
+		auto old_state = $state.load();
+		do {
+			if (old_state != promise_state::loss_notify &&
+				old_state != promise_state::has_notify) {
+				return false;
+			}
+		} while (!$state.compare_exchange_weak(
+			old_state, promise_state::harvested));
+		return true;
+	}
+
+	// Destroys a cancelled promise, the holder of a queued promise uses it to
+	// drop the promise without fulfilling it.
+	bool try_discard() noexcept {
+		if ($state.load() != promise_state::harvested) {
+			return false;
+		}
+		assert(
+			$state.exchange(promise_state::destroying) ==
+			promise_state::harvested);
+		on_destroy();
+		return true;
+	}
+
 	//////////////////// unused ////////////////////
 
 	void unuse() noexcept {
@@ -166,8 +180,69 @@ protected:
 private:
 	std::atomic<promise_state> $state;
 	expected<T> $val;
-	std::function<void()> $notify;
-	std::function<void(expected<T>)> $on_unharvested;
+	move_only_function<void()> $notify;
+	move_only_function<void(expected<T>)> $on_unharvested;
+#ifdef __cpp_lib_coroutine
+	coroutine_handle<> $co;
+#endif
+
+	// Returns false if the promise has been cancelled, the value is left in
+	// $val then.
+	bool $fulfill(
+		expected<T> &&value,
+		move_only_function<void(expected<T>)> &&on_unharvested) noexcept {
+
+		assert(std::is_void<T>::value || !$val);
+
+		$val = std::move(value);
+		$on_unharvested = std::move(on_unharvested);
+
+		auto old_state = $state.exchange(promise_state::fulfilled);
+
+		assert(old_state != promise_state::fulfilled);
+
+		switch (old_state) {
+
+		case promise_state::harvested:
+			assert(
+				$state.exchange(promise_state::destroying) ==
+				promise_state::fulfilled);
+			return false;
+
+		case promise_state::has_notify: {
+#ifdef __cpp_lib_coroutine
+			if ($co) {
+				exchange($co, nullptr).resume();
+				break;
+			}
+#endif
+			assert($notify);
+			auto notify = std::move($notify);
+			notify();
+			break;
+		}
+
+		default:
+			break;
+		}
+		return true;
+	}
+
+	bool $await_suspend() noexcept {
+		auto old_state = $state.load();
+		if (old_state == promise_state::loss_notify) {
+			$state.compare_exchange_strong(
+				old_state, promise_state::has_notify);
+		}
+
+		assert(old_state != promise_state::has_notify);
+		assert(old_state != promise_state::harvested);
+		assert(
+			old_state == promise_state::loss_notify ||
+			old_state == promise_state::fulfilled);
+
+		return old_state != promise_state::fulfilled;
+	}
 };
 
 template <typename T, typename Extend>
@@ -219,6 +294,25 @@ public:
 	void on_destroy() noexcept override {
 		delete this;
 	}
+
+	// Most of them are harvested on the thread that created them, so they
+	// are recycled through the per-thread pool.
+
+	static void *operator new(size_t size) {
+		if (size != sizeof(newable_promise)) {
+			return ::operator new(size);
+		}
+		return pool_allocator<newable_promise>().allocate(1);
+	}
+
+	static void operator delete(void *ptr, size_t size) {
+		if (size != sizeof(newable_promise)) {
+			::operator delete(ptr);
+			return;
+		}
+		pool_allocator<newable_promise>().deallocate(
+			reinterpret_cast<newable_promise *>(ptr), 1);
+	}
 };
 
 } // namespace rua
@@ -0,0 +1,193 @@
+#ifndef _rua_conc_select_hpp
+#define _rua_conc_select_hpp
+
+#include "chan.hpp"
+#include "future.hpp"
+#include "promise.hpp"
+#include "timer.hpp"
+
+#include "../time/duration.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <initializer_list>
+#include <memory>
+
+namespace rua {
+
+template <typename T>
+struct select_result {
+	size_t index;
+	T value;
+};
+
+template <typename T>
+class _select_ctx;
+
+template <typename T>
+class _select_wtr : public chan_waiter<T> {
+public:
+	_select_ctx<T> *ctx;
+	size_t ix;
+
+	virtual ~_select_wtr() = default;
+
+protected:
+	void on_destroy() noexcept override {
+		ctx->$unref();
+	}
+};
+
+/*
+	Every chan gets a waiter of its own, the first one fulfilled claims the
+	result.
+
+	Once the result is claimed and all waiters are queued, the other waiters
+	are cancelled, so their chans drop them. A waiter fulfilled before that
+	unharvests its value and the chan sends it again, so nothing is lost.
+	Cancelling the result before any waiter is fulfilled cancels all of them.
+	The context is freed with the last waiter.
+*/
+
+template <typename T>
+class _select_ctx : public promise<select_result<T>> {
+public:
+	explicit _select_ctx(std::initializer_list<chan<T> *> chs) :
+		promise<select_result<T>>(),
+		$n(chs.size()),
+		$chs(new chan<T> *[chs.size()]),
+		$wtrs(new _select_wtr<T>[chs.size()]),
+		$refs(chs.size() + 2),
+		$is_claimed(false),
+		$winner(chs.size()),
+		$started_n(0),
+		$votes(0) {
+		size_t i = 0;
+		for (auto ch : chs) {
+			$chs[i] = ch;
+			$wtrs[i].ch = ch;
+			$wtrs[i].ctx = this;
+			$wtrs[i].ix = i;
+			++i;
+		}
+	}
+
+	virtual ~_select_ctx() = default;
+
+	void start() {
+		size_t i = 0;
+		for (; i < $n && !$is_claimed.load(); ++i) {
+			auto &wtr = $wtrs[i];
+			// A fresh promise always suspends.
+			wtr.await_suspend([this, i]() { $on_ready(i); });
+			$chs[i]->recv_to(wtr);
+		}
+		$started_n = i;
+		for (; i < $n; ++i) {
+			$wtrs[i].unuse();
+		}
+		$vote();
+	}
+
+	bool cancel() noexcept override {
+		if ($is_claimed.exchange(true)) {
+			return promise<select_result<T>>::cancel();
+		}
+		auto is_cancelled = promise<select_result<T>>::cancel();
+		assert(is_cancelled);
+		$vote();
+		this->unfulfill();
+		return is_cancelled;
+	}
+
+protected:
+	void on_destroy() noexcept override {
+		$unref();
+	}
+
+private:
+	size_t $n;
+	std::unique_ptr<chan<T> *[]> $chs;
+	std::unique_ptr<_select_wtr<T>[]> $wtrs;
+	std::atomic<size_t> $refs;
+	std::atomic<bool> $is_claimed;
+	size_t $winner, $started_n;
+	std::atomic<int> $votes;
+
+	void $on_ready(size_t ix) {
+		auto &wtr = $wtrs[ix];
+		if ($is_claimed.exchange(true)) {
+			wtr.unharvest();
+			return;
+		}
+		$winner = ix;
+		auto val = wtr.await_resume();
+		assert(val);
+		$vote();
+		auto ch = $chs[ix];
+		this->fulfill(
+			select_result<T>{ix, *std::move(val)},
+			[ch](expected<select_result<T>> r) {
+				if (!r) {
+					return;
+				}
+				ch->send(std::move((*r).value));
+			});
+	}
+
+	// Both start() and the claimer vote, the later one cancels the losers.
+	void $vote() {
+		if (++$votes < 2) {
+			return;
+		}
+		for (size_t i = 0; i < $started_n; ++i) {
+			if (i != $winner) {
+				$wtrs[i].cancel();
+			}
+		}
+		$unref();
+	}
+
+	void $unref() {
+		if (--$refs == 0) {
+			delete this;
+		}
+	}
+
+	friend _select_wtr<T>;
+};
+
+// Receives from whichever chan is ready first, the earlier chans are
+// checked first.
+// Resolves to err_waiting_timeout if none is ready in time.
+template <typename T>
+inline future<select_result<T>> select(
+	std::initializer_list<chan<T> *> chs, duration timeout = duration_max()) {
+	assert(chs.size());
+
+	size_t i = 0;
+	for (auto ch : chs) {
+		auto val_opt = ch->try_recv();
+		if (val_opt) {
+			return select_result<T>{i, *std::move(val_opt)};
+		}
+		++i;
+	}
+	if (timeout <= 0) {
+		return err_waiting_timeout;
+	}
+
+	auto ctx = new _select_ctx<T>(chs);
+	future<select_result<T>> r(static_cast<promise<select_result<T>> &>(*ctx));
+	ctx->start();
+
+	if (timeout == duration_max()) {
+		return r;
+	}
+	return with_timeout(std::move(r), timeout);
+}
+
+} // namespace rua
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _rua_conc_semaphore_hpp
+#define _rua_conc_semaphore_hpp
+
+#include "future.hpp"
+#include "promise.hpp"
+
+#include "../lockfree_queue.hpp"
+#include "../pool_allocator.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+
+namespace rua {
+
+// Works like mutex, with a number of permits instead of a single owner.
+class semaphore {
+public:
+	class releaser {
+	public:
+		constexpr releaser() : $sem(nullptr) {}
+
+		~releaser() {
+			(*this)();
+		}
+
+		releaser(const releaser &) = delete;
+
+		releaser &operator=(const releaser &) = delete;
+
+		releaser(releaser &&src) : $sem(exchange(src.$sem, nullptr)) {}
+
+		releaser &operator=(releaser &&src) noexcept {
+			(*this)();
+			$sem = exchange(src.$sem, nullptr);
+			return *this;
+		}
+
+		explicit operator bool() const noexcept {
+			return $sem;
+		}
+
+		void operator()() {
+			if (!$sem) {
+				return;
+			}
+
+			auto sem = exchange($sem, nullptr);
+
+			// $c < 0 is the number of waiters.
+			if (sem->$c++ >= 0) {
+				return;
+			}
+			sem->$pop_wtr()->fulfill(releaser(*sem));
+		}
+
+	private:
+		semaphore *$sem;
+
+		explicit releaser(semaphore &sem) : $sem(&sem) {}
+
+		friend semaphore;
+	};
+
+	constexpr explicit semaphore(size_t permits) :
+		$c(static_cast<ssize_t>(permits)), $wtrs() {}
+
+	semaphore(const semaphore &) = delete;
+
+	semaphore &operator=(const semaphore &) = delete;
+
+	releaser try_acquire() noexcept {
+		auto c = $c.load();
+		do {
+			if (c <= 0) {
+				return releaser();
+			}
+		} while (!$c.compare_exchange_weak(c, c - 1));
+		return releaser(*this);
+	}
+
+	future<releaser> acquire() {
+		if ($c-- > 0) {
+			return releaser(*this);
+		}
+
+		auto prm = new newable_promise<releaser>;
+		$wtrs.emplace_back(prm);
+		return future<releaser>(*prm);
+	}
+
+private:
+	std::atomic<ssize_t> $c;
+	lockfree_queue<promise<releaser> *, pool_allocator<promise<releaser> *>>
+		$wtrs;
+
+	// The acquirer decreases $c before it queues up, so it may still be in
+	// flight for a short moment.
+	promise<releaser> *$pop_wtr() {
+		_lockfree_backoff bo;
+		for (;;) {
+			auto wtr_opt = $wtrs.pop_front();
+			if (wtr_opt) {
+				assert(*wtr_opt);
+				return *wtr_opt;
+			}
+			bo.snooze();
+		}
+	}
+
+	friend releaser;
+};
+
+} // namespace rua
+
+#endif
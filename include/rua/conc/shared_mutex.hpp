@@ -0,0 +1,273 @@
+#ifndef _rua_conc_shared_mutex_hpp
+#define _rua_conc_shared_mutex_hpp
+
+#include "future.hpp"
+#include "promise.hpp"
+
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <deque>
+
+namespace rua {
+
+/*
+	Readers take the lock with a single CAS as long as no writer holds it or
+	waits for it, and release it with a single decrement.
+
+	A waiting writer stops new readers, which queue up behind it, so writers
+	are not starved. When a writer unlocks, the readers queued meanwhile go
+	first, all at once, then the next writer.
+
+	The waiters are kept under a spin lock that is only taken on contention.
+*/
+
+class shared_mutex {
+public:
+	class unlocker {
+	public:
+		constexpr unlocker() : $mtx(nullptr) {}
+
+		~unlocker() {
+			(*this)();
+		}
+
+		unlocker(const unlocker &) = delete;
+
+		unlocker &operator=(const unlocker &) = delete;
+
+		unlocker(unlocker &&src) : $mtx(exchange(src.$mtx, nullptr)) {}
+
+		unlocker &operator=(unlocker &&src) noexcept {
+			(*this)();
+			$mtx = exchange(src.$mtx, nullptr);
+			return *this;
+		}
+
+		explicit operator bool() const noexcept {
+			return $mtx;
+		}
+
+		void operator()() {
+			if (!$mtx) {
+				return;
+			}
+			exchange($mtx, nullptr)->$unlock();
+		}
+
+	private:
+		shared_mutex *$mtx;
+
+		explicit unlocker(shared_mutex &mtx) : $mtx(&mtx) {}
+
+		friend shared_mutex;
+	};
+
+	class shared_unlocker {
+	public:
+		constexpr shared_unlocker() : $mtx(nullptr) {}
+
+		~shared_unlocker() {
+			(*this)();
+		}
+
+		shared_unlocker(const shared_unlocker &) = delete;
+
+		shared_unlocker &operator=(const shared_unlocker &) = delete;
+
+		shared_unlocker(shared_unlocker &&src) :
+			$mtx(exchange(src.$mtx, nullptr)) {}
+
+		shared_unlocker &operator=(shared_unlocker &&src) noexcept {
+			(*this)();
+			$mtx = exchange(src.$mtx, nullptr);
+			return *this;
+		}
+
+		explicit operator bool() const noexcept {
+			return $mtx;
+		}
+
+		void operator()() {
+			if (!$mtx) {
+				return;
+			}
+			exchange($mtx, nullptr)->$unlock_shared();
+		}
+
+	private:
+		shared_mutex *$mtx;
+
+		explicit shared_unlocker(shared_mutex &mtx) : $mtx(&mtx) {}
+
+		friend shared_mutex;
+	};
+
+	shared_mutex() : $state(0), $locked(false) {}
+
+	shared_mutex(const shared_mutex &) = delete;
+
+	shared_mutex &operator=(const shared_mutex &) = delete;
+
+	unlocker try_lock() noexcept {
+		size_t old_state = 0;
+		return $state.compare_exchange_strong(old_state, $writing)
+				   ? unlocker(*this)
+				   : unlocker();
+	}
+
+	future<unlocker> lock() {
+		size_t s = 0;
+		if ($state.compare_exchange_strong(s, $writing)) {
+			return unlocker(*this);
+		}
+
+		$lock();
+		s = $state.load();
+		for (;;) {
+			if (!(s & ~$readers_waiting) && $wtr_wtrs.empty()) {
+				if ($state.compare_exchange_weak(s, s | $writing)) {
+					$unlock_wtrs();
+					return unlocker(*this);
+				}
+				continue;
+			}
+			if ($state.compare_exchange_weak(s, s | $writers_waiting)) {
+				break;
+			}
+		}
+		auto prm = new newable_promise<unlocker>;
+		$wtr_wtrs.emplace_back(prm);
+		$unlock_wtrs();
+		return future<unlocker>(*prm);
+	}
+
+	shared_unlocker try_lock_shared() noexcept {
+		auto s = $state.load();
+		while (!(s & ($writing | $writers_waiting))) {
+			if ($state.compare_exchange_weak(s, s + $reader)) {
+				return shared_unlocker(*this);
+			}
+		}
+		return shared_unlocker();
+	}
+
+	future<shared_unlocker> lock_shared() {
+		auto ul = try_lock_shared();
+		if (ul) {
+			return ul;
+		}
+
+		$lock();
+		auto s = $state.load();
+		for (;;) {
+			if (!(s & ($writing | $writers_waiting))) {
+				if ($state.compare_exchange_weak(s, s + $reader)) {
+					$unlock_wtrs();
+					return shared_unlocker(*this);
+				}
+				continue;
+			}
+			if ($state.compare_exchange_weak(s, s | $readers_waiting)) {
+				break;
+			}
+		}
+		auto prm = new newable_promise<shared_unlocker>;
+		$rdr_wtrs.emplace_back(prm);
+		$unlock_wtrs();
+		return future<shared_unlocker>(*prm);
+	}
+
+private:
+	static constexpr size_t $writing = 1;
+	static constexpr size_t $writers_waiting = 2;
+	static constexpr size_t $readers_waiting = 4;
+	static constexpr size_t $reader = 8;
+
+	std::atomic<size_t> $state;
+	std::atomic<bool> $locked;
+	std::deque<promise<shared_unlocker> *> $rdr_wtrs;
+	std::deque<promise<unlocker> *> $wtr_wtrs;
+
+	void $lock() {
+		while ($locked.exchange(true, std::memory_order_acquire))
+			;
+	}
+
+	void $unlock_wtrs() {
+		$locked.store(false, std::memory_order_release);
+	}
+
+	void $unlock() {
+		size_t s = $writing;
+		if ($state.compare_exchange_strong(s, 0)) {
+			return;
+		}
+
+		$lock();
+
+		// Nobody else changes the state while it is being written.
+		assert($state.load() & $writing);
+
+		if ($rdr_wtrs.size()) {
+			auto rdrs = std::move($rdr_wtrs);
+			$rdr_wtrs.clear();
+			$state.store(
+				rdrs.size() * $reader |
+				($wtr_wtrs.empty() ? 0 : $writers_waiting));
+			$unlock_wtrs();
+
+			for (auto rdr : rdrs) {
+				rdr->fulfill(shared_unlocker(*this));
+			}
+			return;
+		}
+
+		if ($wtr_wtrs.size()) {
+			auto wtr = $wtr_wtrs.front();
+			$wtr_wtrs.pop_front();
+			$state.store(
+				$writing | ($wtr_wtrs.empty() ? 0 : $writers_waiting));
+			$unlock_wtrs();
+
+			wtr->fulfill(unlocker(*this));
+			return;
+		}
+
+		$state.store(0);
+		$unlock_wtrs();
+	}
+
+	void $unlock_shared() {
+		auto s = $state.fetch_sub($reader);
+		assert(s >= $reader);
+
+		// The last reader hands the lock over to the first waiting writer.
+		if (s / $reader != 1 || !(s & $writers_waiting)) {
+			return;
+		}
+
+		$lock();
+		s = $state.load();
+		if (s >= $reader || (s & $writing) || $wtr_wtrs.empty()) {
+			$unlock_wtrs();
+			return;
+		}
+		auto wtr = $wtr_wtrs.front();
+		$wtr_wtrs.pop_front();
+		$state.store(
+			$writing | (s & $readers_waiting) |
+			($wtr_wtrs.empty() ? 0 : $writers_waiting));
+		$unlock_wtrs();
+
+		wtr->fulfill(unlocker(*this));
+	}
+
+	friend unlocker;
+	friend shared_unlocker;
+};
+
+} // namespace rua
+
+#endif
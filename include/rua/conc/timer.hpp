@@ -0,0 +1,548 @@
+#ifndef _rua_conc_timer_hpp
+#define _rua_conc_timer_hpp
+
+#include "await.hpp"
+#include "future.hpp"
+#include "promise.hpp"
+#include "wait.hpp"
+
+#include "../error.hpp"
+#include "../move_only.hpp"
+#include "../pool_allocator.hpp"
+#include "../thread/core.hpp"
+#include "../thread/parker.hpp"
+#include "../thread/wait.hpp"
+#include "../time/duration.hpp"
+#include "../time/tick.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace rua {
+
+class timer_wheel;
+
+// An intrusive timer, it stays put while it is pending and needs no
+// allocation of its own.
+class timer {
+public:
+	timer() :
+		$wheel(nullptr),
+		$prev(nullptr),
+		$next(nullptr),
+		$expiry(0),
+		$lv(0),
+		$ix(0),
+		$cb() {}
+
+	~timer() {
+		cancel();
+	}
+
+	timer(const timer &) = delete;
+
+	timer &operator=(const timer &) = delete;
+
+	inline bool is_pending() const;
+
+	// Returns false when it was not pending, including when the callback is
+	// already running.
+	inline bool cancel();
+
+private:
+	std::atomic<timer_wheel *> $wheel;
+	timer *$prev, *$next;
+	uint64_t $expiry;
+	uint8_t $lv, $ix;
+	move_only_function<void()> $cb;
+
+	friend timer_wheel;
+};
+
+/*
+	Reference from
+		http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+
+	4 levels of 64 slots with a resolution of 1 millisecond, a timer sits on
+	the level of the highest 6-bit digit in which its expiry differs from the
+	current time, and cascades down when the time enters its slot. Timers
+	further than 2^24 milliseconds are kept aside and reinserted every 2^24
+	milliseconds.
+
+	The wheel is driven by its own thread, which parks until the next
+	occupied slot. The callbacks run on that thread, they must not block.
+*/
+
+class timer_wheel {
+public:
+	timer_wheel() :
+		$begin(tick()),
+		$now(0),
+		$ovf_epoch(0),
+		$slots(),
+		$bits(),
+		$ovf(nullptr),
+		$is_sleeping(false),
+		$sleep_until(0),
+		$sleep_ticket(0),
+		$exiting(false),
+		$thrd([this]() { $run(); }) {}
+
+	timer_wheel(const timer_wheel &) = delete;
+
+	timer_wheel &operator=(const timer_wheel &) = delete;
+
+	~timer_wheel() {
+		parker::ticket_t ticket;
+		{
+			std::lock_guard<std::mutex> lg($mtx);
+			$exiting = true;
+			ticket = $sleep_ticket;
+		}
+		$pkr.unpark(ticket);
+		wait($thrd);
+	}
+
+	// Reschedules the timer if it is pending.
+	void schedule(
+		timer &tmr, duration timeout, move_only_function<void()> callback) {
+		auto expiry = $ceil_ms(tick() - $begin + $clamp(timeout));
+
+		auto need_unpark = false;
+		parker::ticket_t ticket;
+		{
+			std::lock_guard<std::mutex> lg($mtx);
+			if (tmr.$wheel.load() == this) {
+				$unlink(tmr);
+			} else {
+				assert(!tmr.$wheel.load());
+			}
+			tmr.$cb = std::move(callback);
+			tmr.$wheel.store(this);
+			$insert(tmr, expiry);
+
+			if ($is_sleeping && expiry < $sleep_until) {
+				$is_sleeping = false;
+				need_unpark = true;
+				ticket = $sleep_ticket;
+			}
+		}
+		if (need_unpark) {
+			$pkr.unpark(ticket);
+		}
+	}
+
+	bool cancel(timer &tmr) {
+		std::lock_guard<std::mutex> lg($mtx);
+		if (tmr.$wheel.load() != this) {
+			return false;
+		}
+		$unlink(tmr);
+		tmr.$wheel.store(nullptr);
+		tmr.$cb = nullptr;
+		return true;
+	}
+
+private:
+	static constexpr size_t $lv_n = 4;
+	static constexpr size_t $lv_bits = 6;
+	static constexpr size_t $slot_n = 1 << $lv_bits;
+	static constexpr uint8_t $ovf_lv = $lv_n;
+	static constexpr uint64_t $never = nmax<uint64_t>();
+
+	duration $begin;
+	uint64_t $now, $ovf_epoch;
+	timer *$slots[$lv_n][$slot_n];
+	uint64_t $bits[$lv_n];
+	timer *$ovf;
+
+	std::mutex $mtx;
+	parker $pkr;
+	bool $is_sleeping;
+	uint64_t $sleep_until;
+	parker::ticket_t $sleep_ticket;
+	bool $exiting;
+	std::vector<move_only_function<void()>> $firing;
+	thread $thrd;
+
+	uint64_t $elapsed() const {
+		return static_cast<uint64_t>((tick() - $begin).milliseconds());
+	}
+
+	// About 35 thousand years.
+	static duration $clamp(duration timeout) {
+		if (timeout <= 0) {
+			return 0;
+		}
+		auto max = duration(static_cast<int64_t>(1) << 50);
+		return timeout > max ? max : timeout;
+	}
+
+	static uint64_t $ceil_ms(duration d) {
+		auto ms = d.milliseconds();
+		if (duration(ms) < d) {
+			++ms;
+		}
+		return static_cast<uint64_t>(ms);
+	}
+
+	static size_t $digit(uint64_t t, size_t lv) {
+		return static_cast<size_t>(t >> (lv * $lv_bits)) & ($slot_n - 1);
+	}
+
+	static size_t $highest_bit(uint64_t x) {
+		size_t h = 0;
+		while (x >>= 1) {
+			++h;
+		}
+		return h;
+	}
+
+	static size_t $lowest_bit(uint64_t x) {
+		size_t l = 0;
+		while (!(x & 1)) {
+			x >>= 1;
+			++l;
+		}
+		return l;
+	}
+
+	timer *&$head(timer &tmr) {
+		return tmr.$lv == $ovf_lv ? $ovf : $slots[tmr.$lv][tmr.$ix];
+	}
+
+	void $insert(timer &tmr, uint64_t expiry) {
+		tmr.$expiry = expiry;
+
+		if (expiry <= $now) {
+			tmr.$lv = 0;
+			tmr.$ix = static_cast<uint8_t>($digit($now, 0));
+		} else {
+			auto lv = $highest_bit(expiry ^ $now) / $lv_bits;
+			if (lv >= $lv_n) {
+				tmr.$lv = $ovf_lv;
+				tmr.$ix = 0;
+			} else {
+				tmr.$lv = static_cast<uint8_t>(lv);
+				tmr.$ix = static_cast<uint8_t>($digit(expiry, lv));
+			}
+		}
+
+		auto &head = $head(tmr);
+		tmr.$prev = nullptr;
+		tmr.$next = head;
+		if (head) {
+			head->$prev = &tmr;
+		}
+		head = &tmr;
+		if (tmr.$lv != $ovf_lv) {
+			$bits[tmr.$lv] |= static_cast<uint64_t>(1) << tmr.$ix;
+		}
+	}
+
+	void $unlink(timer &tmr) {
+		if (tmr.$prev) {
+			tmr.$prev->$next = tmr.$next;
+		} else {
+			$head(tmr) = tmr.$next;
+		}
+		if (tmr.$next) {
+			tmr.$next->$prev = tmr.$prev;
+		}
+		if (tmr.$lv != $ovf_lv && !$slots[tmr.$lv][tmr.$ix]) {
+			$bits[tmr.$lv] &= ~(static_cast<uint64_t>(1) << tmr.$ix);
+		}
+	}
+
+	// Detaches a whole list, clearing its bit.
+	timer *$take(timer *&head, size_t lv, size_t ix) {
+		auto front = head;
+		head = nullptr;
+		if (lv != $ovf_lv) {
+			$bits[lv] &= ~(static_cast<uint64_t>(1) << ix);
+		}
+		return front;
+	}
+
+	void $reinsert(timer *front) {
+		while (front) {
+			auto next = front->$next;
+			$insert(*front, front->$expiry);
+			front = next;
+		}
+	}
+
+	void $fire(timer *front) {
+		while (front) {
+			auto next = front->$next;
+			$firing.emplace_back(std::move(front->$cb));
+			front->$cb = nullptr;
+			front->$wheel.store(nullptr);
+			front = next;
+		}
+	}
+
+	// The earliest time after $now at which something has to be done.
+	uint64_t $next_deadline() const {
+		for (size_t lv = 0; lv < $lv_n; ++lv) {
+			auto d = $digit($now, lv);
+			auto bits = $bits[lv] & (~static_cast<uint64_t>(0) << d);
+			if (!bits) {
+				continue;
+			}
+			auto shift = (lv + 1) * $lv_bits;
+			auto prefix = shift < 64 ? ($now >> shift) << shift : 0;
+			return prefix |
+				   (static_cast<uint64_t>($lowest_bit(bits)) << (lv * $lv_bits));
+		}
+		if ($ovf) {
+			auto shift = $lv_n * $lv_bits;
+			return (($now >> shift) + 1) << shift;
+		}
+		return $never;
+	}
+
+	void $set_now(uint64_t t) {
+		$now = t;
+		auto epoch = $now >> ($lv_n * $lv_bits);
+		if (epoch != $ovf_epoch) {
+			$ovf_epoch = epoch;
+			$reinsert($take($ovf, $ovf_lv, 0));
+		}
+	}
+
+	// Collects the callbacks that are due at $now.
+	void $expire() {
+		for (size_t lv = $lv_n - 1; lv > 0; --lv) {
+			auto ix = $digit($now, lv);
+			if ($slots[lv][ix]) {
+				$reinsert($take($slots[lv][ix], lv, ix));
+			}
+		}
+		auto ix = $digit($now, 0);
+		$fire($take($slots[0][ix], 0, ix));
+	}
+
+	void $advance(uint64_t t) {
+		$expire();
+		for (;;) {
+			auto d = $next_deadline();
+			if (d > t) {
+				break;
+			}
+			$set_now(d);
+			$expire();
+		}
+		if (t > $now) {
+			$set_now(t);
+		}
+	}
+
+	void $run() {
+		for (;;) {
+			std::unique_lock<std::mutex> ul($mtx);
+			$is_sleeping = false;
+			if ($exiting) {
+				return;
+			}
+
+			$advance($elapsed());
+			if (!$firing.empty()) {
+				ul.unlock();
+				for (auto &cb : $firing) {
+					cb();
+				}
+				$firing.clear();
+				continue;
+			}
+
+			auto deadline = $next_deadline();
+			auto ticket = $pkr.prepare();
+			$sleep_ticket = ticket;
+			$sleep_until = deadline;
+			$is_sleeping = true;
+			ul.unlock();
+
+			if (deadline == $never) {
+				$pkr.park(ticket);
+			} else {
+				auto now = $elapsed();
+				if (deadline > now) {
+					$pkr.park(
+						ticket, duration(static_cast<int64_t>(deadline - now)));
+				}
+			}
+			$pkr.finish(ticket);
+		}
+	}
+};
+
+inline bool timer::is_pending() const {
+	return $wheel.load();
+}
+
+inline bool timer::cancel() {
+	auto wheel = $wheel.load();
+	return wheel && wheel->cancel(*this);
+}
+
+// Intentionally leaked, its thread never exits.
+inline timer_wheel &default_timer_wheel() {
+	static auto inst = new timer_wheel;
+	return *inst;
+}
+
+inline future<>
+sleep_for(duration timeout, timer_wheel &wheel = default_timer_wheel()) {
+	if (timeout <= 0) {
+		return expected<>();
+	}
+	auto prm = new newable_promise<void, timer>;
+	wheel.schedule(prm->extend(), timeout, [prm]() { prm->fulfill(); });
+	return *prm;
+}
+
+template <typename R, typename Awaiter>
+inline enable_if_t<
+	!std::is_void<decltype(std::declval<Awaiter &>().await_resume())>::value,
+	expected<R>>
+_resume_expected(Awaiter &awaiter) {
+	return awaiter.await_resume();
+}
+
+template <typename R, typename Awaiter>
+inline enable_if_t<
+	std::is_void<decltype(std::declval<Awaiter &>().await_resume())>::value,
+	expected<R>>
+_resume_expected(Awaiter &awaiter) {
+	awaiter.await_resume();
+	return meet_expected;
+}
+
+template <typename Awaiter>
+inline auto _cancel_awaiter(Awaiter &awaiter, int)
+	-> decltype(static_cast<bool>(awaiter.cancel())) {
+	return awaiter.cancel();
+}
+
+template <typename Awaiter>
+inline bool _cancel_awaiter(Awaiter &, ...) {
+	return false;
+}
+
+/*
+	The awaitable and the timer race for the result, the loser only drops its
+	reference. When the timer wins, an owned awaitable that can be cancelled
+	(such as a future) is cancelled at once, so a chan drops its receiver.
+	Otherwise it is dropped without being resumed once it is ready, so a
+	future unharvests its value (a chan sends it again).
+*/
+
+template <typename AwaiterWrapper, typename R>
+class _timeout_ctx : public promise<R> {
+public:
+	AwaiterWrapper aw;
+	timer tmr;
+
+	explicit _timeout_ctx(AwaiterWrapper &&aw) :
+		promise<R>(), aw(std::move(aw)), $refs(3), $is_done(false) {}
+
+	virtual ~_timeout_ctx() = default;
+
+	void on_ready() {
+		if (!$is_done.exchange(true)) {
+			if (tmr.cancel()) {
+				$unref();
+			}
+			this->fulfill(_resume_expected<R>(*aw));
+		}
+		$unref();
+	}
+
+	void on_timeout() {
+		if (!$is_done.exchange(true)) {
+			// A cancelled awaitable will not call on_ready().
+			if (!std::is_reference<typename AwaiterWrapper::storage_t>::value &&
+				_cancel_awaiter(*aw, 0)) {
+				$unref();
+			}
+			this->fulfill(err_waiting_timeout);
+		}
+		$unref();
+	}
+
+	void start(timer_wheel &wheel, duration timeout) {
+		wheel.schedule(tmr, timeout, [this]() { on_timeout(); });
+		// on_ready() may have run before the timer was scheduled.
+		if ($is_done.load() && tmr.cancel()) {
+			$unref();
+		}
+	}
+
+	static void *operator new(size_t size) {
+		if (size != sizeof(_timeout_ctx)) {
+			return ::operator new(size);
+		}
+		return pool_allocator<_timeout_ctx>().allocate(1);
+	}
+
+	static void operator delete(void *ptr, size_t size) {
+		if (size != sizeof(_timeout_ctx)) {
+			::operator delete(ptr);
+			return;
+		}
+		pool_allocator<_timeout_ctx>().deallocate(
+			reinterpret_cast<_timeout_ctx *>(ptr), 1);
+	}
+
+protected:
+	void on_destroy() noexcept override {
+		$unref();
+	}
+
+private:
+	std::atomic<size_t> $refs;
+	std::atomic<bool> $is_done;
+
+	void $unref() {
+		if (--$refs == 0) {
+			delete this;
+		}
+	}
+};
+
+// Resolves to err_waiting_timeout if the awaitable is not ready in time.
+template <
+	typename Awaitable,
+	typename R = unwarp_expected_t<decay_t<await_result_t<Awaitable &&>>>>
+inline future<R> with_timeout(
+	Awaitable &&awaitable,
+	duration timeout,
+	timer_wheel &wheel = default_timer_wheel()) {
+	auto aw = wrap_awaiter(std::forward<Awaitable>(awaitable));
+	if (aw->await_ready()) {
+		return _resume_expected<R>(*aw);
+	}
+	if (timeout <= 0) {
+		return err_waiting_timeout;
+	}
+
+	using ctx_t = _timeout_ctx<awaiter_wrapper<Awaitable &&>, R>;
+	auto ctx = new ctx_t(std::move(aw));
+
+	// The timer is scheduled after suspending, so on_timeout() never
+	// cancels an awaitable that is still being suspended.
+	if (!await_suspend(*ctx->aw, [ctx]() { ctx->on_ready(); })) {
+		ctx->on_ready();
+	}
+	ctx->start(wheel, timeout);
+	return future<R>(static_cast<promise<R> &>(*ctx));
+}
+
+} // namespace rua
+
+#endif
@@ -4,29 +4,117 @@
 #include "await.hpp"
 
 #include "../error.hpp"
-#include "../thread/dozer.hpp"
+#include "../lockfree_queue.hpp"
+#include "../thread/parker.hpp"
+#include "../thread/var.hpp"
 #include "../time/tick.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <memory>
 
 namespace rua {
 
+// Lets a user-space scheduler running on the thread (e.g. fibers) park its
+// task instead of the thread, with the same protocol as parker.
+// It must never be freed, a late notify may still unpark it.
+class _task_parker {
+public:
+	using ticket_t = parker::ticket_t;
+
+	virtual ~_task_parker() = default;
+
+	virtual ticket_t prepare() = 0;
+
+	virtual bool park(ticket_t ticket, duration timeout = duration_max()) = 0;
+
+	virtual void unpark(ticket_t ticket) = 0;
+
+	virtual void finish(ticket_t ticket) = 0;
+};
+
+struct _wait_ctx_t {
+	parker pkr;
+	_task_parker *task_pkr;
+
+	_wait_ctx_t() : task_pkr(nullptr) {}
+};
+
+// A late notifier may still unpark a context after its thread exited, so the
+// contexts are recycled instead of freed.
+inline lockfree_queue<_wait_ctx_t *> &_idle_wait_ctxs() {
+	static auto inst = new lockfree_queue<_wait_ctx_t *>;
+	return *inst;
+}
+
+inline _wait_ctx_t *_new_wait_ctx() {
+	auto ctx_opt = _idle_wait_ctxs().pop_front();
+	return ctx_opt ? *ctx_opt : new _wait_ctx_t;
+}
+
+// Every thread reuses its own parker, so waiting costs no allocation.
+inline _wait_ctx_t *_this_wait_ctx() {
+	static auto wv = new thread_word_var([](any_word val) {
+		if (!val) {
+			return;
+		}
+		_idle_wait_ctxs().emplace_back(val.as<_wait_ctx_t *>());
+	});
+	if (!wv->is_storable()) {
+		return nullptr;
+	}
+	auto ctx = wv->get().as<_wait_ctx_t *>();
+	if (!ctx) {
+		ctx = _new_wait_ctx();
+		wv->set(ctx);
+	}
+	return ctx;
+}
+
+// Falls back to a temporary context where thread vars are not storable.
+inline _wait_ctx_t *_acquire_wait_ctx(bool &is_tmp_ctx) {
+	auto ctx = _this_wait_ctx();
+	is_tmp_ctx = !ctx;
+	return ctx ? ctx : _new_wait_ctx();
+}
+
+inline void _release_wait_ctx(_wait_ctx_t *ctx, bool is_tmp_ctx) {
+	if (is_tmp_ctx) {
+		_idle_wait_ctxs().emplace_back(ctx);
+	}
+}
+
+// Returns false on timeout.
+// The parker is never freed and a stale ticket is ignored, so the notify only
+// carries a pointer and a ticket and is stored inline.
+template <typename Parker, typename Awaiter>
+inline bool _park_on(Parker *pkr, Awaiter &awaiter, duration timeout) {
+	auto ticket = pkr->prepare();
+	auto ok = true;
+	if (await_suspend(awaiter, [pkr, ticket]() { pkr->unpark(ticket); })) {
+		ok = pkr->park(ticket, timeout);
+	}
+	pkr->finish(ticket);
+	return ok;
+}
+
+template <typename Awaiter>
+inline bool _wait_suspend(Awaiter &awaiter, duration timeout) {
+	bool is_tmp_ctx;
+	auto ctx = _acquire_wait_ctx(is_tmp_ctx);
+	auto ok = ctx->task_pkr ? _park_on(ctx->task_pkr, awaiter, timeout)
+							: _park_on(&ctx->pkr, awaiter, timeout);
+	_release_wait_ctx(ctx, is_tmp_ctx);
+	return ok;
+}
+
 template <typename Awaitable, typename Result = await_result_t<Awaitable &&>>
 inline Result wait(Awaitable &&awaitable) {
 	auto &&awaiter = make_awaiter(std::forward<Awaitable>(awaitable));
 	if (awaiter.await_ready()) {
 		return awaiter.await_resume();
 	}
-	dozer dzr;
-	auto wkr_wptr = dzr.get_waker();
-	if (await_suspend(awaiter, [wkr_wptr]() {
-			auto wkr_sp = wkr_wptr.lock();
-			assert(wkr_sp);
-			wkr_sp->wake();
-		})) {
-		while (!dzr.doze())
-			;
-	}
+	_wait_suspend(awaiter, duration_max());
 	return awaiter.await_resume();
 }
 
@@ -58,26 +146,9 @@ try_wait(Awaitable &&awaitable, duration timeout = 0) {
 		return err_waiting_timeout;
 	}
 
-	dozer dzr;
-	auto wkr_wptr = dzr.get_waker();
-	if (!await_suspend(awaiter, [wkr_wptr]() {
-			auto wkr_sp = wkr_wptr.lock();
-			assert(wkr_sp);
-			wkr_sp->wake();
-		})) {
+	if (_wait_suspend(awaiter, timeout)) {
 		return awaiter.await_resume();
 	}
-
-	auto end_ti = tick() + timeout;
-	for (;;) {
-		auto ok = dzr.doze(timeout);
-		if (ok) {
-			return awaiter.await_resume();
-		}
-		if (!ok || assign(timeout, end_ti - tick()) <= 0) {
-			break;
-		}
-	}
 	return err_waiting_timeout;
 }
 
@@ -98,28 +169,10 @@ try_wait(Awaitable &&awaitable, duration timeout = 0) {
 		return err_waiting_timeout;
 	}
 
-	dozer dzr;
-	auto wkr_wptr = dzr.get_waker();
-	if (!await_suspend(awaiter, [wkr_wptr]() {
-			auto wkr_sp = wkr_wptr.lock();
-			assert(wkr_sp);
-			wkr_sp->wake();
-		})) {
+	if (_wait_suspend(awaiter, timeout)) {
 		awaiter.await_resume();
 		return meet_expected;
 	}
-
-	auto end_ti = tick() + timeout;
-	for (;;) {
-		auto ok = dzr.doze(timeout);
-		if (ok) {
-			awaiter.await_resume();
-			return meet_expected;
-		}
-		if (!ok || assign(timeout, end_ti - tick()) <= 0) {
-			break;
-		}
-	}
 	return err_waiting_timeout;
 }
 
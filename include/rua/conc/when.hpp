@@ -0,0 +1,251 @@
+#ifndef _rua_conc_when_hpp
+#define _rua_conc_when_hpp
+
+#include "future.hpp"
+#include "promise.hpp"
+
+#include "../error.hpp"
+#include "../range/traits.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <vector>
+
+namespace rua {
+
+/*
+	Joins a range of futures through one promise shared by all of them, each
+	future that completes counts it down, and only the one that decides the
+	result wakes up the waiter.
+
+	The futures that are ready already are harvested without suspending, when
+	the result is decided by them, nothing is allocated.
+
+	The range is taken by value, pass it with std::move().
+*/
+
+RUA_CVAR strv_error err_when_nothing("nothing to wait for");
+
+template <typename Future>
+struct _when_value {};
+
+template <typename T, typename PromiseValue>
+struct _when_value<future<T, PromiseValue>> : type_identity<T> {};
+
+template <typename Futures>
+using _when_future_t = typename range_traits<Futures>::value_type;
+
+template <typename Futures>
+using _when_value_t = typename _when_value<_when_future_t<Futures>>::type;
+
+////////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename Future>
+class _when_all_state : public promise<std::vector<expected<T>>> {
+public:
+	template <typename Futures>
+	explicit _when_all_state(Futures &futs) {
+		for (auto &fut : futs) {
+			$futs.emplace_back(std::move(fut));
+		}
+		$rets.resize($futs.size());
+
+		// Holds one more until every future is started.
+		$left.store($futs.size() + 1);
+	}
+
+	virtual ~_when_all_state() = default;
+
+	future<std::vector<expected<T>>> start() {
+		future<std::vector<expected<T>>> r(*this);
+		for (size_t i = 0; i < $futs.size(); ++i) {
+			auto &fut = $futs[i];
+			if (fut.await_ready() ||
+				!fut.await_suspend([this, i]() { $done(i); })) {
+				$done(i);
+			}
+		}
+		$release();
+		return r;
+	}
+
+protected:
+	void on_destroy() noexcept override {
+		delete this;
+	}
+
+private:
+	std::vector<Future> $futs;
+	std::vector<expected<T>> $rets;
+	std::atomic<size_t> $left;
+
+	void $done(size_t ix) {
+		$rets[ix] = $futs[ix].await_resume();
+		$release();
+	}
+
+	void $release() {
+		if ($left.fetch_sub(1) == 1) {
+			this->fulfill(std::move($rets));
+		}
+	}
+};
+
+// Waits for every future, the results are in the order of the futures.
+template <
+	typename Futures,
+	typename T = _when_value_t<Futures>,
+	typename Future = _when_future_t<Futures>>
+inline future<std::vector<expected<T>>> when_all(Futures futs) {
+	size_t n = 0;
+	bool is_all_ready = true;
+	for (auto &fut : futs) {
+		++n;
+		if (!fut.await_ready()) {
+			is_all_ready = false;
+		}
+	}
+	if (!is_all_ready) {
+		return (new _when_all_state<T, Future>(futs))->start();
+	}
+
+	std::vector<expected<T>> rets;
+	rets.reserve(n);
+	for (auto &fut : futs) {
+		rets.emplace_back(fut.await_resume());
+	}
+	return rets;
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct when_any_result {
+	size_t index;
+	expected<T> value;
+};
+
+/*
+	The first future that completes decides the result.
+
+	Once the result is decided and all futures are started, the others are
+	cancelled without being harvested, so a chan drops its receiver. A loser
+	completed before that is left unharvested and reset with the state, so a
+	chan sends its value again. Cancelling the result before it is decided
+	cancels all of them.
+*/
+
+template <typename T, typename Future>
+class _when_any_state : public promise<when_any_result<T>> {
+public:
+	template <typename Futures>
+	explicit _when_any_state(Futures &futs) :
+		$is_decided(false), $started_n(0), $votes(0) {
+		for (auto &fut : futs) {
+			$futs.emplace_back(std::move(fut));
+		}
+		$winner = $futs.size();
+
+		// The losers still notify it, so it is also held by each future
+		// besides the waiter.
+		$refs.store($futs.size() + 1);
+	}
+
+	virtual ~_when_any_state() = default;
+
+	future<when_any_result<T>> start() {
+		future<when_any_result<T>> r(*this);
+		size_t i = 0;
+		for (; i < $futs.size() && !$is_decided.load(); ++i) {
+			auto &fut = $futs[i];
+			if (fut.await_ready() ||
+				!fut.await_suspend([this, i]() { $done(i); })) {
+				$done(i);
+			}
+		}
+		$started_n = i;
+		for (; i < $futs.size(); ++i) {
+			$release();
+		}
+		$vote();
+		return r;
+	}
+
+	bool cancel() noexcept override {
+		if ($is_decided.exchange(true)) {
+			return promise<when_any_result<T>>::cancel();
+		}
+		auto is_cancelled = promise<when_any_result<T>>::cancel();
+		assert(is_cancelled);
+		$vote();
+		this->unfulfill();
+		return is_cancelled;
+	}
+
+protected:
+	void on_destroy() noexcept override {
+		$release();
+	}
+
+private:
+	std::vector<Future> $futs;
+	std::atomic<bool> $is_decided;
+	size_t $winner, $started_n;
+	std::atomic<int> $votes;
+	std::atomic<size_t> $refs;
+
+	void $done(size_t ix) {
+		if (!$is_decided.exchange(true)) {
+			$winner = ix;
+			auto ret = $futs[ix].await_resume();
+			$vote();
+			this->fulfill(when_any_result<T>{ix, std::move(ret)});
+		}
+		$release();
+	}
+
+	// Both start() and the decider vote, the later one cancels the losers.
+	void $vote() {
+		if (++$votes < 2) {
+			return;
+		}
+		for (size_t i = 0; i < $started_n; ++i) {
+			// A cancelled future will not notify.
+			if (i != $winner && $futs[i].cancel()) {
+				$release();
+			}
+		}
+	}
+
+	void $release() {
+		if ($refs.fetch_sub(1) == 1) {
+			delete this;
+		}
+	}
+};
+
+// Waits for the first future to complete, the others are cancelled, or
+// reset unharvested if they complete before that.
+template <
+	typename Futures,
+	typename T = _when_value_t<Futures>,
+	typename Future = _when_future_t<Futures>>
+inline future<when_any_result<T>> when_any(Futures futs) {
+	size_t n = 0;
+	for (auto &fut : futs) {
+		if (fut.await_ready()) {
+			// The others are reset with the range.
+			return when_any_result<T>{n, fut.await_resume()};
+		}
+		++n;
+	}
+	if (!n) {
+		return err_when_nothing;
+	}
+	return (new _when_any_state<T, Future>(futs))->start();
+}
+
+} // namespace rua
+
+#endif
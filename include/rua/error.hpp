@@ -395,6 +395,33 @@ private:
 	error_i $err;
 };
 
+template <typename T>
+inline decltype(std::declval<const T &>() == std::declval<const T &>(), bool())
+operator==(const expected<T> &a, const expected<T> &b) {
+	if (a.has_value() != b.has_value()) {
+		return false;
+	}
+	return a.has_value() ? a.value() == b.value() : a.error() == b.error();
+}
+
+template <typename T>
+inline decltype(std::declval<const T &>() == std::declval<const T &>(), bool())
+operator!=(const expected<T> &a, const expected<T> &b) {
+	return !(a == b);
+}
+
+template <typename T>
+inline enable_if_t<std::is_void<T>::value, bool>
+operator==(const expected<T> &a, const expected<T> &b) {
+	return a.error() == b.error();
+}
+
+template <typename T>
+inline enable_if_t<std::is_void<T>::value, bool>
+operator!=(const expected<T> &a, const expected<T> &b) {
+	return !(a == b);
+}
+
 ////////////////////////////////////////////////////////////////////////////
 
 template <typename T>
@@ -0,0 +1,8 @@
+#ifndef _rua_fiber_hpp
+#define _rua_fiber_hpp
+
+#include "fiber/scheduler.hpp"
+#include "fiber/shared_stack.hpp"
+#include "fiber/stack.hpp"
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef _rua_fiber_scheduler_hpp
+#define _rua_fiber_scheduler_hpp
+
+#include "../conc/future.hpp"
+#include "../conc/timer.hpp"
+#include "../conc/wait.hpp"
+#include "../hard.hpp"
+#include "../lockfree_queue.hpp"
+#include "../move_only.hpp"
+#include "../pool_allocator.hpp"
+#include "../thread/core.hpp"
+#include "../thread/parallel.hpp"
+#include "../thread/parker.hpp"
+#include "../thread/wait.hpp"
+#include "../ucontext.hpp"
+#include "../util.hpp"
+#include "shared_stack.hpp"
+#include "stack.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace rua {
+
+/*
+	Fibers are multiplexed over a fixed set of worker threads, each fiber
+	sticks to the worker that started it.
+
+	rua::wait() (and so the * operator) called inside a fiber parks the
+	fiber and lets the worker run the others, so the code written against
+	the blocking API scales to a large number of concurrent tasks.
+
+	A fiber must not block its worker by other means, and must not let an
+	exception escape from its task.
+
+	Each worker takes the fiber stacks from its own stack_pool, a finished
+	fiber gives its stack back and is reused by the next task of the same
+	worker. Fibers are never freed, a late notify may still unpark one of
+	them.
+
+	With shares_stack, each worker runs all its fibers on one shared_stack of
+	stack_size instead, a suspended fiber only keeps a copy of the frames it
+	uses. Then a fiber must not hand out the addresses of its locals to
+	anything that runs while it is suspended.
+*/
+
+class fiber_scheduler {
+public:
+	explicit fiber_scheduler(
+		size_t num_workers = 0,
+		size_t stack_size = 256 * 1024,
+		bool shares_stack = false) :
+		$next_wkr(0), $exiting(false), $spawning(0) {
+		if (!num_workers) {
+			num_workers = num_cpus();
+			if (!num_workers) {
+				num_workers = 1;
+			}
+		}
+		$wkrs.reserve(num_workers);
+		for (size_t i = 0; i < num_workers; ++i) {
+			$wkrs.emplace_back(new $worker_t(*this, stack_size, shares_stack));
+		}
+		for (auto &wkr : $wkrs) {
+			auto wkr_ptr = wkr.get();
+			wkr->thrd = thread([wkr_ptr]() { wkr_ptr->owner.$run(*wkr_ptr); });
+		}
+	}
+
+	fiber_scheduler(const fiber_scheduler &) = delete;
+
+	fiber_scheduler &operator=(const fiber_scheduler &) = delete;
+
+	// Waits for every fiber to finish.
+	~fiber_scheduler() {
+		$exiting.store(true);
+		for (auto &wkr : $wkrs) {
+			wkr->notify();
+		}
+		for (auto &wkr : $wkrs) {
+			wait(wkr->thrd);
+		}
+	}
+
+	size_t size() const {
+		return $wkrs.size();
+	}
+
+	// Returns false without touching the task once the scheduler is exiting.
+	bool spawn(move_only_function<void()> &&task) {
+		// Counted before checking $exiting, so that no worker exits while
+		// the task may still be on its way to it.
+		++$spawning;
+		if ($exiting.load()) {
+			$spawned();
+			return false;
+		}
+		auto &wkr = *$wkrs[$next_wkr++ % $wkrs.size()];
+		wkr.tasks.emplace_back(std::move(task));
+		wkr.notify();
+		$spawned();
+		return true;
+	}
+
+private:
+	struct $worker_t;
+	struct $fiber_t;
+
+	// Fibers only switch to and from their worker by calls, so the lighter
+	// switch that keeps no more than a call does is enough.
+
+#ifdef RUA_JUMP_UCONTEXT
+
+	using $ctx_t = jump_ucontext_t;
+
+	static void $make_ctx($fiber_t &fbr) {
+		make_jump_ucontext(&fbr.ctx, &$fiber_t::$entry, fbr.stack);
+	}
+
+	static void $switch_in($worker_t &wkr, $fiber_t &fbr) {
+		jump_ucontext(&wkr.ctx, &fbr.ctx, &fbr);
+	}
+
+	static void $switch_out($fiber_t &fbr) {
+		jump_ucontext(&fbr.ctx, &fbr.wkr.ctx);
+	}
+
+	static void $exit($fiber_t &fbr) {
+		$switch_out(fbr);
+	}
+
+#else
+
+	using $ctx_t = ucontext_t;
+
+	static void $make_ctx($fiber_t &fbr) {
+		get_ucontext(&fbr.ctx);
+		make_ucontext(&fbr.ctx, &$fiber_t::$entry, &fbr, fbr.stack);
+	}
+
+	static void $switch_in($worker_t &wkr, $fiber_t &fbr) {
+		swap_ucontext(&wkr.ctx, &fbr.ctx);
+	}
+
+	static void $switch_out($fiber_t &fbr) {
+		swap_ucontext(&fbr.ctx, &fbr.wkr.ctx);
+	}
+
+	static void $exit($fiber_t &fbr) {
+		set_ucontext(&fbr.wkr.ctx);
+	}
+
+#endif
+
+	struct $fiber_t : _task_parker {
+		$worker_t &wkr;
+		$ctx_t ctx;
+		bytes_ref stack;
+		shared_stack::saver svr;
+
+		// Kept off the stack, the timer wheel links it while suspended.
+		timer tmr;
+		move_only_function<void()> task;
+		bool is_done;
+
+		// (epoch << 3) | is_timed_out | is_parked | permit
+		std::atomic<ticket_t> state;
+
+		static constexpr ticket_t permit = 1;
+		static constexpr ticket_t is_parked = 2;
+		static constexpr ticket_t is_timed_out = 4;
+		static constexpr ticket_t epoch_one = 8;
+
+		explicit $fiber_t($worker_t &wkr) :
+			wkr(wkr), is_done(false), state(0) {}
+
+		virtual ~$fiber_t() = default;
+
+		ticket_t prepare() override {
+			auto s = state.load(std::memory_order_relaxed);
+			assert(!(s & (epoch_one - 1)));
+			return s;
+		}
+
+		bool park(ticket_t ticket, duration timeout) override {
+			if (timeout != duration_max()) {
+				default_timer_wheel().schedule(tmr, timeout, [this, ticket]() {
+					$unpark(ticket, is_timed_out);
+				});
+			}
+
+			auto s = ticket;
+			if (state.compare_exchange_strong(s, ticket | is_parked)) {
+				$switch_out(*this);
+				s = state.load();
+			}
+			assert(s & permit);
+
+			tmr.cancel();
+			return !(s & is_timed_out);
+		}
+
+		void unpark(ticket_t ticket) override {
+			$unpark(ticket, 0);
+		}
+
+		void finish(ticket_t ticket) override {
+			state.store(ticket + epoch_one);
+		}
+
+		void $unpark(ticket_t ticket, ticket_t flags) {
+			auto s = state.load();
+			do {
+				if ((s & ~(epoch_one - 1)) != ticket || (s & permit)) {
+					return;
+				}
+			} while (!state.compare_exchange_weak(s, s | permit | flags));
+
+			if (s & is_parked) {
+				wkr.woken.emplace_back(this);
+				wkr.notify();
+			}
+		}
+
+		// Every ticket of a finished fiber is stale, so it is never resumed
+		// and its stack is free to go.
+		static void $entry(any_word param) {
+			auto fbr = param.as<$fiber_t *>();
+			fbr->task();
+			fbr->task = nullptr;
+			fbr->is_done = true;
+			$exit(*fbr);
+		}
+	};
+
+	struct $worker_t {
+		fiber_scheduler &owner;
+		thread thrd;
+		$ctx_t ctx;
+		stack_pool stacks;
+		std::unique_ptr<shared_stack> shared_stk;
+
+		lockfree_queue<$fiber_t *, pool_allocator<$fiber_t *>> woken;
+		lockfree_queue<
+			move_only_function<void()>,
+			pool_allocator<move_only_function<void()>>>
+			tasks;
+
+		// Only touched by the worker itself.
+		std::deque<$fiber_t *> runnables;
+		std::vector<$fiber_t *> idle_fbrs;
+		size_t num_alive;
+
+		parker pkr;
+		std::atomic<parker::ticket_t> idle_ticket;
+		std::atomic<bool> is_idle;
+
+		$worker_t(
+			fiber_scheduler &owner, size_t stack_size, bool shares_stack) :
+			owner(owner),
+			stacks(stack_size),
+			shared_stk(shares_stack ? new shared_stack(stack_size) : nullptr),
+			num_alive(0),
+			idle_ticket(0),
+			is_idle(false) {}
+
+		void notify() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (is_idle.exchange(false)) {
+				pkr.unpark(idle_ticket.load());
+			}
+		}
+	};
+
+	std::vector<std::unique_ptr<$worker_t>> $wkrs;
+	std::atomic<size_t> $next_wkr;
+	std::atomic<bool> $exiting;
+	std::atomic<size_t> $spawning;
+
+	// The last spawn in flight wakes the workers that are waiting for it to
+	// exit.
+	void $spawned() {
+		if (--$spawning || !$exiting.load()) {
+			return;
+		}
+		for (auto &wkr : $wkrs) {
+			wkr->notify();
+		}
+	}
+
+	bool $can_exit($worker_t &wkr) {
+		return $exiting.load() && !$spawning.load() && !wkr.num_alive &&
+			   wkr.tasks.empty();
+	}
+
+	$fiber_t *$new_fiber($worker_t &wkr) {
+		$fiber_t *fbr;
+		if (wkr.idle_fbrs.size()) {
+			fbr = wkr.idle_fbrs.back();
+			wkr.idle_fbrs.pop_back();
+			fbr->is_done = false;
+		} else {
+			fbr = new $fiber_t(wkr);
+		}
+		if (wkr.shared_stk) {
+			// The initial frame may be written to the stack.
+			wkr.shared_stk->restore(fbr->svr, fbr->ctx);
+			fbr->stack = wkr.shared_stk->stack();
+		} else {
+			fbr->stack = wkr.stacks.alloc();
+		}
+		assert(fbr->stack.size());
+		$make_ctx(*fbr);
+		return fbr;
+	}
+
+	// Returns false when there is nothing to run.
+	bool $fetch($worker_t &wkr) {
+		for (;;) {
+			auto fbr_opt = wkr.woken.pop_front();
+			if (!fbr_opt) {
+				break;
+			}
+			wkr.runnables.emplace_back(*fbr_opt);
+		}
+		if (wkr.runnables.size()) {
+			return true;
+		}
+		auto task_opt = wkr.tasks.pop_front();
+		if (!task_opt) {
+			return false;
+		}
+		auto fbr = $new_fiber(wkr);
+		fbr->task = std::move(*task_opt);
+		wkr.runnables.emplace_back(fbr);
+		++wkr.num_alive;
+		return true;
+	}
+
+	void $run($worker_t &wkr) {
+		auto wait_ctx = _this_wait_ctx();
+		assert(wait_ctx);
+
+		for (;;) {
+			if (!$fetch(wkr)) {
+				if ($can_exit(wkr)) {
+					break;
+				}
+
+				auto ticket = wkr.pkr.prepare();
+				wkr.idle_ticket.store(ticket);
+				wkr.is_idle.store(true);
+
+				// Checks again, the wakes before is_idle have not notified.
+				if ($fetch(wkr) || $can_exit(wkr)) {
+					wkr.is_idle.store(false);
+					wkr.pkr.finish(ticket);
+					continue;
+				}
+				wkr.pkr.park(ticket);
+				wkr.pkr.finish(ticket);
+				wkr.is_idle.store(false);
+				continue;
+			}
+
+			auto fbr = wkr.runnables.front();
+			wkr.runnables.pop_front();
+
+			if (wkr.shared_stk) {
+				wkr.shared_stk->restore(fbr->svr, fbr->ctx);
+			}
+
+			wait_ctx->task_pkr = fbr;
+			$switch_in(wkr, *fbr);
+			wait_ctx->task_pkr = nullptr;
+
+			if (fbr->is_done) {
+				--wkr.num_alive;
+				if (wkr.shared_stk) {
+					wkr.shared_stk->release(fbr->svr);
+					fbr->stack = nullptr;
+				} else {
+					wkr.stacks.dealloc(exchange(fbr->stack, nullptr));
+				}
+				wkr.idle_fbrs.emplace_back(fbr);
+			}
+		}
+	}
+};
+
+// Intentionally leaked, so that exiting the process does not wait for the
+// fibers.
+inline fiber_scheduler &default_fiber_scheduler() {
+	static auto inst = new fiber_scheduler;
+	return *inst;
+}
+
+inline void _fiber_post(move_only_function<void()> f) {
+	auto is_spawned = default_fiber_scheduler().spawn(std::move(f));
+	assert(is_spawned);
+	(void)is_spawned;
+}
+
+// Runs on the default_fiber_scheduler().
+template <typename Func, typename... Args>
+inline auto fiber(Func func, Args &&...args)
+	-> decltype(_parallel_call<_fiber_post>(
+		std::move(func), std::forward<Args>(args)...)) {
+	return _parallel_call<_fiber_post>(
+		std::move(func), std::forward<Args>(args)...);
+}
+
+} // namespace rua
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef _rua_fiber_shared_stack_hpp
+#define _rua_fiber_shared_stack_hpp
+
+#include "stack.hpp"
+
+#include "../binary/bytes.hpp"
+#include "../ucontext.hpp"
+#include "../util.hpp"
+
+#include <cassert>
+#include <cstring>
+
+namespace rua {
+
+/*
+	Reference from
+		https://github.com/hnes/libaco
+
+	Many contexts take turns running on one large stack. When a context is
+	switched in, the used part of the stack of the one that ran on it before
+	is copied out to a saver of the right size, and its own is copied back.
+
+	So a suspended context only costs the few hundred bytes its frames use,
+	in exchange for a copy per switch between different contexts.
+
+	The addresses of the locals of a suspended context are not valid, they
+	must not be handed out to anyone who may touch them meanwhile.
+
+	Not thread safe, each thread runs on a stack of its own.
+*/
+
+class shared_stack {
+public:
+	class saver {
+	public:
+		saver() : $ctx(nullptr), $get_sp(nullptr) {}
+
+		saver(const saver &) = delete;
+
+		saver &operator=(const saver &) = delete;
+
+		// The bytes of frames it holds while suspended.
+		size_t size() const {
+			return $buf.size();
+		}
+
+	private:
+		bytes $buf;
+		const void *$ctx;
+		uintptr_t (*$get_sp)(const void *);
+
+		friend shared_stack;
+	};
+
+	explicit shared_stack(size_t stack_size = 8 * 1024 * 1024) :
+		$pool(stack_size, 0, 0), $stk($pool.alloc()), $owner(nullptr) {
+		assert($stk.size());
+	}
+
+	~shared_stack() {
+		$pool.dealloc($stk);
+	}
+
+	shared_stack(const shared_stack &) = delete;
+
+	shared_stack &operator=(const shared_stack &) = delete;
+
+	// For make_ucontext(), only after restore() with the saver of ucp.
+	bytes_ref stack() const {
+		return $stk;
+	}
+
+	// Puts the frames of ctx (a ucontext_t or a jump_ucontext_t) on the
+	// stack, call it off this stack right before switching to ctx.
+	template <typename UContext>
+	void restore(saver &svr, const UContext &ctx) {
+		svr.$ctx = &ctx;
+		svr.$get_sp = [](const void *ctx) -> uintptr_t {
+			return any_ptr(static_cast<const UContext *>(ctx)->sp()).uintptr();
+		};
+		if ($owner == &svr) {
+			return;
+		}
+		if ($owner) {
+			$save(*$owner);
+		}
+		$owner = &svr;
+
+		auto n = svr.$buf.size();
+		if (n) {
+			memcpy($top() - n, svr.$buf.data(), n);
+		}
+	}
+
+	// Drops the frames of a context that finished.
+	void release(saver &svr) {
+		if ($owner == &svr) {
+			$owner = nullptr;
+		}
+		svr.$buf.reset();
+		svr.$ctx = nullptr;
+		svr.$get_sp = nullptr;
+	}
+
+private:
+	stack_pool $pool;
+	bytes_ref $stk;
+	saver *$owner;
+
+	uchar *$top() {
+		return $stk.data() + $stk.size();
+	}
+
+	void $save(saver &svr) {
+		assert(svr.$ctx);
+
+		auto sp = reinterpret_cast<uchar *>(svr.$get_sp(svr.$ctx));
+		assert(sp >= $stk.data() && sp <= $top());
+
+		auto n = static_cast<size_t>($top() - sp);
+
+		// Shrinks the saver that once held a deep stack.
+		if (svr.$buf.capacity() > n * 4) {
+			svr.$buf.reset();
+		}
+		svr.$buf.reset(n);
+		memcpy(svr.$buf.data(), sp, n);
+	}
+};
+
+} // namespace rua
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef _rua_fiber_stack_hpp
+#define _rua_fiber_stack_hpp
+
+#include "../binary/bytes.hpp"
+#include "../memory.hpp"
+#include "../util.hpp"
+
+#include <cassert>
+#include <vector>
+
+namespace rua {
+
+/*
+	Stacks for make_ucontext(), reserved from the system page by page and
+	committed lazily, only the pages a fiber touches cost memory.
+
+	Below each stack there is an inaccessible guard page, so an overflow
+	faults instead of corrupting the neighbour.
+
+	Windows commits the memory it hands out, so there only the top pages are
+	committed up front, with a PAGE_GUARD page below them. Touching it
+	commits the next one, as the system does for the thread stacks, which it
+	only grows for the stack that the thread started on.
+
+	Freed stacks are reused last in first out. The ones that sink below the
+	most recently used num_hot are discarded to the system, the address range
+	is kept and refilled with zeros on demand.
+
+	Not thread safe, keep one per thread (e.g. per fiber_scheduler worker).
+*/
+
+class stack_pool {
+public:
+	explicit stack_pool(
+		size_t stack_size = 256 * 1024,
+		size_t num_hot = 16,
+		size_t max_idle = nmax<size_t>()) :
+		$page_sz(mem_page_size()),
+		$stack_sz(
+			(stack_size + mem_page_size() - 1) / mem_page_size() *
+			mem_page_size()),
+		$num_hot(num_hot),
+		$max_idle(max_idle) {}
+
+	~stack_pool() {
+		for (auto &idle : $idles) {
+			$unmap(idle.base);
+		}
+	}
+
+	stack_pool(const stack_pool &) = delete;
+
+	stack_pool &operator=(const stack_pool &) = delete;
+
+	// The usable size, rounded up to the page size.
+	size_t stack_size() const {
+		return $stack_sz;
+	}
+
+	size_t num_idle() const {
+		return $idles.size();
+	}
+
+	// Returns an empty bytes_ref on failure.
+	bytes_ref alloc() {
+		uchar *base;
+		if ($idles.size()) {
+			base = $idles.back().base;
+			$idles.pop_back();
+		} else {
+			base = $map();
+			if (!base) {
+				return nullptr;
+			}
+		}
+		return bytes_ref(base + $page_sz, $stack_sz);
+	}
+
+	void dealloc(bytes_ref stack) {
+		if (!stack.data()) {
+			return;
+		}
+		assert(stack.size() == $stack_sz);
+
+		auto base = stack.data() - $page_sz;
+		if ($idles.size() >= $max_idle) {
+			$unmap(base);
+			return;
+		}
+		$idles.push_back($idle_t{base, false});
+
+		if ($idles.size() <= $num_hot) {
+			return;
+		}
+		auto &cold = $idles[$idles.size() - 1 - $num_hot];
+		if (!cold.is_trimmed) {
+			$discard(cold.base);
+			cold.is_trimmed = true;
+		}
+	}
+
+	// Discards every idle stack, hot or not.
+	void trim() {
+		for (auto &idle : $idles) {
+			if (!idle.is_trimmed) {
+				$discard(idle.base);
+				idle.is_trimmed = true;
+			}
+		}
+	}
+
+private:
+	struct $idle_t {
+		uchar *base;
+		bool is_trimmed;
+	};
+
+	size_t $page_sz, $stack_sz, $num_hot, $max_idle;
+	std::vector<$idle_t> $idles;
+
+	uchar *$map() const {
+		auto total = $page_sz + $stack_sz;
+
+#ifdef _WIN32
+
+		static auto grower = AddVectoredExceptionHandler(1, &$grow);
+		if (!grower) {
+			return nullptr;
+		}
+
+		// The bottom page is never committed.
+		auto base = reinterpret_cast<uchar *>(
+			VirtualAlloc(nullptr, total, MEM_RESERVE, PAGE_NOACCESS));
+		if (!base) {
+			return nullptr;
+		}
+		auto top_sz = $top_size();
+		if (!VirtualAlloc(
+				base + total - top_sz, top_sz, MEM_COMMIT, PAGE_READWRITE) ||
+			(top_sz < $stack_sz &&
+			 !VirtualAlloc(
+				 base + total - top_sz - $page_sz,
+				 $page_sz,
+				 MEM_COMMIT,
+				 PAGE_READWRITE | PAGE_GUARD))) {
+			VirtualFree(base, 0, MEM_RELEASE);
+			return nullptr;
+		}
+		return base;
+
+#else
+
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+		flags |= MAP_STACK;
+#endif
+		auto ptr = mmap(nullptr, total, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (ptr == MAP_FAILED) {
+			return nullptr;
+		}
+		auto base = reinterpret_cast<uchar *>(ptr);
+		if (mprotect(base, $page_sz, PROT_NONE)) {
+			munmap(base, total);
+			return nullptr;
+		}
+		return base;
+
+#endif
+	}
+
+	void $unmap(uchar *base) const {
+#ifdef _WIN32
+		VirtualFree(base, 0, MEM_RELEASE);
+#else
+		munmap(base, $page_sz + $stack_sz);
+#endif
+	}
+
+	void $discard(uchar *base) const {
+#ifdef _WIN32
+		// Shrinks back to the top pages, the guard page stays committed.
+		auto top_sz = $top_size();
+		if (top_sz < $stack_sz) {
+			auto guard = base + $page_sz + $stack_sz - top_sz - $page_sz;
+			if (guard > base + $page_sz) {
+				VirtualFree(
+					base + $page_sz, guard - base - $page_sz, MEM_DECOMMIT);
+			}
+			DWORD old_mode;
+			VirtualProtect(
+				guard, $page_sz, PAGE_READWRITE | PAGE_GUARD, &old_mode);
+		}
+		VirtualAlloc(
+			base + $page_sz + $stack_sz - top_sz,
+			top_sz,
+			MEM_RESET,
+			PAGE_READWRITE);
+#else
+		madvise(base + $page_sz, $stack_sz, MADV_DONTNEED);
+#endif
+	}
+
+#ifdef _WIN32
+
+	size_t $top_size() const {
+		return $stack_sz < 2 * $page_sz ? $stack_sz : 2 * $page_sz;
+	}
+
+	// Commits the next guard page when the running stack touches its guard
+	// page, the system has already made that one accessible.
+	static LONG NTAPI $grow(PEXCEPTION_POINTERS info) {
+		auto rec = info->ExceptionRecord;
+		if (rec->ExceptionCode != STATUS_GUARD_PAGE_VIOLATION ||
+			rec->NumberParameters < 2) {
+			return EXCEPTION_CONTINUE_SEARCH;
+		}
+
+		auto tib = reinterpret_cast<NT_TIB *>(NtCurrentTeb());
+		MEMORY_BASIC_INFORMATION stk_info, page_info;
+		if (!VirtualQuery(
+				reinterpret_cast<uchar *>(tib->StackBase) - 1,
+				&stk_info,
+				sizeof(stk_info)) ||
+			!VirtualQuery(
+				reinterpret_cast<void *>(rec->ExceptionInformation[1]),
+				&page_info,
+				sizeof(page_info)) ||
+			page_info.AllocationBase != stk_info.AllocationBase) {
+			return EXCEPTION_CONTINUE_SEARCH;
+		}
+
+		auto page_sz = mem_page_size();
+		auto page = reinterpret_cast<uchar *>(page_info.BaseAddress);
+		auto bottom =
+			reinterpret_cast<uchar *>(page_info.AllocationBase) + page_sz;
+		MEMORY_BASIC_INFORMATION next_info;
+		if (page > bottom &&
+			VirtualQuery(page - page_sz, &next_info, sizeof(next_info)) &&
+			next_info.State == MEM_RESERVE) {
+			VirtualAlloc(
+				page - page_sz,
+				page_sz,
+				MEM_COMMIT,
+				PAGE_READWRITE | PAGE_GUARD);
+		}
+
+		// The stack probes of the compiler start from the limit.
+		tib->StackLimit = page;
+		return EXCEPTION_CONTINUE_EXECUTION;
+	}
+
+#endif
+};
+
+} // namespace rua
+
+#endif
@@ -4,10 +4,13 @@
 #include "util.hpp"
 
 #include <cassert>
+#include <memory>
 
 namespace rua {
 
-template <typename T>
+// Allocator is default-constructed whenever a node is allocated or freed, so
+// it must be stateless.
+template <typename T, typename Allocator = std::allocator<T>>
 class forward_list {
 public:
 	struct node_t {
@@ -18,6 +21,22 @@ public:
 		node_t(Args &&...args) : value(std::forward<Args>(args)...) {}
 	};
 
+	using allocator_type = Allocator;
+
+	template <typename... Args>
+	static node_t *new_node(Args &&...args) {
+		$node_allocator_t na;
+		auto n = $node_allocator_traits::allocate(na, 1);
+		construct(*n, std::forward<Args>(args)...);
+		return n;
+	}
+
+	static void delete_node(node_t *n) {
+		destruct(*n);
+		$node_allocator_t na;
+		$node_allocator_traits::deallocate(na, n, 1);
+	}
+
 	class const_iterator {
 	public:
 		constexpr const_iterator() : $n(nullptr) {}
@@ -122,7 +141,7 @@ public:
 
 	template <typename... Args>
 	iterator emplace_front(Args &&...args) {
-		auto new_front = new node_t(std::forward<Args>(args)...);
+		auto new_front = new_node(std::forward<Args>(args)...);
 		push_front_node(new_front);
 		return iterator(new_front);
 	}
@@ -134,7 +153,7 @@ public:
 
 	template <typename... Args>
 	iterator emplace_back(Args &&...args) {
-		auto new_back = new node_t(std::forward<Args>(args)...);
+		auto new_back = new_node(std::forward<Args>(args)...);
 		push_back_node(new_back);
 		return iterator(new_back);
 	}
@@ -151,7 +170,7 @@ public:
 	iterator emplace_after(const_iterator before, Args &&...args) {
 		assert(before);
 
-		auto new_after = new node_t(std::forward<Args>(args)...);
+		auto new_after = new_node(std::forward<Args>(args)...);
 		insert_after_node(before.node(), new_after);
 		return iterator(new_after);
 	}
@@ -184,7 +203,7 @@ public:
 		assert($front);
 
 		auto &back = $back();
-		delete back;
+		delete_node(back);
 		back = nullptr;
 	}
 
@@ -227,9 +246,10 @@ public:
 		auto n = $front;
 		while (n) {
 			auto after = n->after;
-			delete n;
+			delete_node(n);
 			n = after;
 		}
+		$front = nullptr;
 	}
 
 	node_t *release() {
@@ -239,6 +259,11 @@ public:
 	}
 
 private:
+	using $node_allocator_t = typename std::allocator_traits<
+		Allocator>::template rebind_alloc<node_t>;
+
+	using $node_allocator_traits = std::allocator_traits<$node_allocator_t>;
+
 	node_t *$front;
 
 	T $pop(node_t *&n) {
@@ -246,7 +271,7 @@ private:
 
 		auto after = n->after;
 		T r(std::move(n->value));
-		delete n;
+		delete_node(n);
 		n = after;
 		return r;
 	}
@@ -255,7 +280,7 @@ private:
 		assert(n);
 
 		iterator it(n->after);
-		delete n;
+		delete_node(n);
 		n = it.node();
 		return it;
 	}
@@ -29,4 +29,16 @@ using namespace posix::_hard;
 
 #endif
 
+#ifdef RUA_X86
+
+#include "hard/x86.hpp"
+
+namespace rua {
+
+using namespace x86::_hard;
+
+} // namespace rua
+
+#endif
+
 #endif
@@ -0,0 +1,103 @@
+#ifndef _rua_hard_x86_hpp
+#define _rua_hard_x86_hpp
+
+#include "../util/macros.hpp"
+
+#ifdef RUA_X86
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RUA_TARGET_SSE2 __attribute__((target("sse2")))
+#define RUA_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RUA_TARGET_SSE2
+#define RUA_TARGET_AVX2
+#endif
+
+namespace rua { namespace x86 {
+
+struct _cpu_features_t {
+	bool has_sse2, has_avx2;
+};
+
+inline void _cpuid(uint32_t leaf, uint32_t subleaf, uint32_t (&regs)[4]) {
+#ifdef _MSC_VER
+	int r[4];
+	__cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+	for (int i = 0; i < 4; ++i) {
+		regs[i] = static_cast<uint32_t>(r[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline uint64_t _xgetbv0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+inline const _cpu_features_t &_cpu_features() {
+	static const _cpu_features_t inst = ([]() -> _cpu_features_t {
+		_cpu_features_t feats{false, false};
+
+		uint32_t regs[4];
+		_cpuid(0, 0, regs);
+		auto max_leaf = regs[0];
+		if (max_leaf < 1) {
+			return feats;
+		}
+
+		_cpuid(1, 0, regs);
+		feats.has_sse2 = (regs[3] >> 26) & 1;
+
+		// The OS must also save the YMM registers.
+		auto has_osxsave = (regs[2] >> 27) & 1;
+		auto has_avx = (regs[2] >> 28) & 1;
+		if (max_leaf < 7 || !has_osxsave || !has_avx ||
+			(_xgetbv0() & 6) != 6) {
+			return feats;
+		}
+
+		_cpuid(7, 0, regs);
+		feats.has_avx2 = (regs[1] >> 5) & 1;
+		return feats;
+	})();
+	return inst;
+}
+
+namespace _hard {
+
+inline bool has_sse2() {
+#if RUA_X86 == 64
+	return true;
+#else
+	return _cpu_features().has_sse2;
+#endif
+}
+
+inline bool has_avx2() {
+	return _cpu_features().has_avx2;
+}
+
+} // namespace _hard
+
+using namespace _hard;
+
+}} // namespace rua::x86
+
+#endif
+
+#endif
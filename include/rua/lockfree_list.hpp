@@ -7,13 +7,16 @@
 
 #include <atomic>
 #include <cassert>
+#include <memory>
 
 namespace rua {
 
-template <typename T>
+template <typename T, typename Allocator = std::allocator<T>>
 class lockfree_list {
 public:
-	using node_t = typename forward_list<T>::node_t;
+	using list_t = forward_list<T, Allocator>;
+
+	using node_t = typename list_t::node_t;
 
 	////////////////////////////////////////////////////////////////////////
 
@@ -21,7 +24,7 @@ public:
 
 	constexpr explicit lockfree_list(node_t *front) : $front(front) {}
 
-	constexpr explicit lockfree_list(forward_list<T> li) :
+	constexpr explicit lockfree_list(list_t li) :
 		$front(li.release()) {}
 
 	lockfree_list(lockfree_list &&src) : $front(src.release()) {}
@@ -48,7 +51,7 @@ public:
 
 	template <typename... Args>
 	bool emplace_front(Args &&...args) {
-		auto new_front = new node_t(std::forward<Args>(args)...);
+		auto new_front = list_t::new_node(std::forward<Args>(args)...);
 		auto old_front = $front.load();
 		do {
 			while (old_front == fullptr) {
@@ -83,7 +86,7 @@ public:
 
 	template <typename... Args>
 	void emplace_back(Args &&...args) {
-		auto new_back = new node_t(std::forward<Args>(args)...);
+		auto new_back = list_t::new_node(std::forward<Args>(args)...);
 		new_back->after = nullptr;
 		auto old_front = $front.load();
 		for (;;) {
@@ -100,7 +103,7 @@ public:
 				break;
 			}
 		}
-		forward_list<T> li(old_front);
+		list_t li(old_front);
 		li.push_back_node(new_back);
 		unlock_and_prepend(std::move(li));
 	}
@@ -127,7 +130,7 @@ public:
 		return r;
 	}
 
-	bool prepend(forward_list<T> pp) {
+	bool prepend(list_t pp) {
 		if (!pp) {
 			return false;
 		}
@@ -248,14 +251,14 @@ public:
 		return r;
 	}
 
-	forward_list<T> pop_all() {
+	list_t pop_all() {
 		auto front = $front.load();
 		do {
 			while (front == fullptr) {
 				front = $front.load();
 			}
 		} while (!$front.compare_exchange_strong(front, nullptr));
-		return forward_list<T>(front);
+		return list_t(front);
 	}
 
 	void reset() {
@@ -272,27 +275,27 @@ public:
 #endif
 	}
 
-	forward_list<T> lock() {
+	list_t lock() {
 		auto front = $front.load();
 		do {
 			while (front == fullptr) {
 				front = $front.load();
 			}
 		} while (!$front.compare_exchange_strong(front, fullptr));
-		return forward_list<T>(front);
+		return list_t(front);
 	}
 
-	forward_list<T> lock_if_non_empty() {
+	list_t lock_if_non_empty() {
 		auto front = $front.load();
 		do {
 			while (front == fullptr) {
 				front = $front.load();
 			}
 			if (!front) {
-				return forward_list<T>();
+				return list_t();
 			}
 		} while (!$front.compare_exchange_strong(front, fullptr));
-		return forward_list<T>(front);
+		return list_t(front);
 	}
 
 	void unlock() {
@@ -303,7 +306,7 @@ public:
 #endif
 	}
 
-	void unlock_and_prepend(forward_list<T> pp) {
+	void unlock_and_prepend(list_t pp) {
 		if (!pp) {
 			unlock();
 			return;
@@ -318,10 +321,10 @@ public:
 	template <typename... Args>
 	void unlock_and_emplace(Args &&...args) {
 #ifdef NDEBUG
-		$front.store(new node_t(std::forward<Args>(args)...));
+		$front.store(list_t::new_node(std::forward<Args>(args)...));
 #else
 		assert(
-			$front.exchange(new node_t(std::forward<Args>(args)...)) ==
+			$front.exchange(list_t::new_node(std::forward<Args>(args)...)) ==
 			fullptr);
 #endif
 	}
@@ -335,7 +338,7 @@ private:
 		while (node) {
 			auto n = node;
 			node = node->after;
-			delete n;
+			list_t::delete_node(n);
 		}
 	}
 };
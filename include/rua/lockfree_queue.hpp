@@ -0,0 +1,638 @@
+/*
+	Reference from
+		https://github.com/crossbeam-rs/crossbeam/blob/master/crossbeam-queue/src/seg_queue.rs
+		https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+
+#ifndef _rua_lockfree_queue_hpp
+#define _rua_lockfree_queue_hpp
+
+#include "optional.hpp"
+#include "util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <thread>
+
+namespace rua {
+
+class _lockfree_backoff {
+public:
+	constexpr _lockfree_backoff() : $n(0) {}
+
+	void snooze() {
+		if ($n < 16) {
+			++$n;
+			return;
+		}
+		std::this_thread::yield();
+	}
+
+private:
+	size_t $n;
+};
+
+// Unbounded MPMC queue, values are stored in linked blocks of slots.
+// Both ends cost O(1), and a heap allocation is only needed every 31 values.
+// Allocator must be stateless, blocks are allocated through its rebind.
+template <typename T, typename Allocator = std::allocator<T>>
+class lockfree_queue {
+public:
+	constexpr lockfree_queue() : $head(), $padding(), $tail() {}
+
+	lockfree_queue(const lockfree_queue &) = delete;
+
+	lockfree_queue &operator=(const lockfree_queue &) = delete;
+
+	~lockfree_queue() {
+		auto head = $head.index.load() & ~$has_next;
+		auto tail = $tail.index.load() & ~$has_next;
+		auto block = $head.block.load();
+
+		while (head != tail) {
+			auto offset = (head >> $shift) % $lap;
+			if (offset < $block_cap) {
+				destruct(block->slots[offset].value());
+			} else {
+				auto next = block->next.load();
+				$delete_block(block);
+				block = next;
+			}
+			head += 1 << $shift;
+		}
+		if (block) {
+			$delete_block(block);
+		}
+	}
+
+	operator bool() const {
+		return !empty();
+	}
+
+	bool empty() const {
+		auto head = $head.index.load();
+		auto tail = $tail.index.load();
+		return (head >> $shift) == (tail >> $shift);
+	}
+
+	template <typename... Args>
+	void emplace_back(Args &&...args) {
+		_lockfree_backoff bo;
+		auto tail = $tail.index.load(std::memory_order_acquire);
+		auto block = $tail.block.load(std::memory_order_acquire);
+		$block_t *next_block = nullptr;
+
+		for (;;) {
+			auto offset = (tail >> $shift) % $lap;
+
+			// Another thread is installing the next block.
+			if (offset == $block_cap) {
+				bo.snooze();
+				tail = $tail.index.load(std::memory_order_acquire);
+				block = $tail.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			// Allocate the next block ahead of time, outside the contention.
+			if (offset + 1 == $block_cap && !next_block) {
+				next_block = $new_block();
+			}
+
+			if (!block) {
+				auto new_block = $new_block();
+				$block_t *null_block = nullptr;
+				if ($tail.block.compare_exchange_strong(
+						null_block,
+						new_block,
+						std::memory_order_release,
+						std::memory_order_relaxed)) {
+					$head.block.store(new_block, std::memory_order_release);
+					block = new_block;
+				} else {
+					if (next_block) {
+						$delete_block(next_block);
+					}
+					next_block = new_block;
+					tail = $tail.index.load(std::memory_order_acquire);
+					block = $tail.block.load(std::memory_order_acquire);
+					continue;
+				}
+			}
+
+			auto new_tail = tail + (1 << $shift);
+
+			if (!$tail.index.compare_exchange_weak(
+					tail,
+					new_tail,
+					std::memory_order_seq_cst,
+					std::memory_order_acquire)) {
+				block = $tail.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (offset + 1 == $block_cap) {
+				assert(next_block);
+				auto next_index = new_tail + (1 << $shift);
+				$tail.block.store(next_block, std::memory_order_release);
+				$tail.index.store(next_index, std::memory_order_release);
+				block->next.store(next_block, std::memory_order_release);
+				next_block = nullptr;
+			}
+
+			auto &slot = block->slots[offset];
+			construct(slot.value(), std::forward<Args>(args)...);
+			slot.state.fetch_or($write, std::memory_order_release);
+			break;
+		}
+
+		if (next_block) {
+			$delete_block(next_block);
+		}
+	}
+
+	optional<T> pop_front() {
+		_lockfree_backoff bo;
+		auto head = $head.index.load(std::memory_order_acquire);
+		auto block = $head.block.load(std::memory_order_acquire);
+
+		for (;;) {
+			auto offset = (head >> $shift) % $lap;
+
+			// Another thread is installing the next block.
+			if (offset == $block_cap) {
+				bo.snooze();
+				head = $head.index.load(std::memory_order_acquire);
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			auto new_head = head + (1 << $shift);
+
+			if (!(new_head & $has_next)) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				auto tail = $tail.index.load(std::memory_order_relaxed);
+
+				if ((head >> $shift) == (tail >> $shift)) {
+					return nullopt;
+				}
+
+				if ((head >> $shift) / $lap != (tail >> $shift) / $lap) {
+					new_head |= $has_next;
+				}
+			}
+
+			// The first block is not installed yet.
+			if (!block) {
+				bo.snooze();
+				head = $head.index.load(std::memory_order_acquire);
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (!$head.index.compare_exchange_weak(
+					head,
+					new_head,
+					std::memory_order_seq_cst,
+					std::memory_order_acquire)) {
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (offset + 1 == $block_cap) {
+				auto next = block->wait_next();
+				auto next_index = (new_head & ~$has_next) + (1 << $shift);
+				if (next->next.load(std::memory_order_relaxed)) {
+					next_index |= $has_next;
+				}
+				$head.block.store(next, std::memory_order_release);
+				$head.index.store(next_index, std::memory_order_release);
+			}
+
+			auto &slot = block->slots[offset];
+			slot.wait_write();
+			optional<T> r(std::move(slot.value()));
+			destruct(slot.value());
+
+			if (offset + 1 == $block_cap) {
+				$destroy(block, 0);
+			} else if (
+				slot.state.fetch_or($read, std::memory_order_acq_rel) &
+				$destroy_bit) {
+				$destroy(block, offset + 1);
+			}
+			return r;
+		}
+	}
+
+	// Reserves the slots of a block with a single update of the tail.
+	// The values are copied unless the iterators are move iterators.
+	template <typename ForwardIt>
+	void push_back_many(ForwardIt first, ForwardIt last) {
+		auto n = static_cast<size_t>(std::distance(first, last));
+		if (!n) {
+			return;
+		}
+
+		_lockfree_backoff bo;
+		auto tail = $tail.index.load(std::memory_order_acquire);
+		auto block = $tail.block.load(std::memory_order_acquire);
+		$block_t *next_block = nullptr;
+
+		while (n) {
+			auto offset = (tail >> $shift) % $lap;
+
+			// Another thread is installing the next block.
+			if (offset == $block_cap) {
+				bo.snooze();
+				tail = $tail.index.load(std::memory_order_acquire);
+				block = $tail.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			auto k = $block_cap - offset;
+			if (k > n) {
+				k = n;
+			}
+
+			if (offset + k == $block_cap && !next_block) {
+				next_block = $new_block();
+			}
+
+			if (!block) {
+				auto new_block = $new_block();
+				$block_t *null_block = nullptr;
+				if ($tail.block.compare_exchange_strong(
+						null_block,
+						new_block,
+						std::memory_order_release,
+						std::memory_order_relaxed)) {
+					$head.block.store(new_block, std::memory_order_release);
+					block = new_block;
+				} else {
+					if (next_block) {
+						$delete_block(next_block);
+					}
+					next_block = new_block;
+					tail = $tail.index.load(std::memory_order_acquire);
+					block = $tail.block.load(std::memory_order_acquire);
+					continue;
+				}
+			}
+
+			auto new_tail = tail + (k << $shift);
+
+			if (!$tail.index.compare_exchange_weak(
+					tail,
+					new_tail,
+					std::memory_order_seq_cst,
+					std::memory_order_acquire)) {
+				block = $tail.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (offset + k == $block_cap) {
+				assert(next_block);
+				auto next_index = new_tail + (1 << $shift);
+				$tail.block.store(next_block, std::memory_order_release);
+				$tail.index.store(next_index, std::memory_order_release);
+				block->next.store(next_block, std::memory_order_release);
+				next_block = nullptr;
+			}
+
+			for (auto i = offset; i < offset + k; ++i) {
+				auto &slot = block->slots[i];
+				construct(slot.value(), *first);
+				++first;
+				slot.state.fetch_or($write, std::memory_order_release);
+			}
+			n -= k;
+
+			tail = $tail.index.load(std::memory_order_acquire);
+			block = $tail.block.load(std::memory_order_acquire);
+		}
+
+		if (next_block) {
+			$delete_block(next_block);
+		}
+	}
+
+	// Takes up to n values, a block at a time with a single update of the
+	// head. Returns the number of values taken.
+	template <typename OutputIt>
+	size_t pop_front_many(OutputIt out, size_t n) {
+		size_t r = 0;
+
+		_lockfree_backoff bo;
+		auto head = $head.index.load(std::memory_order_acquire);
+		auto block = $head.block.load(std::memory_order_acquire);
+
+		while (r < n) {
+			auto offset = (head >> $shift) % $lap;
+
+			// Another thread is installing the next block.
+			if (offset == $block_cap) {
+				bo.snooze();
+				head = $head.index.load(std::memory_order_acquire);
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			auto k = $block_cap - offset;
+			auto new_head = head;
+
+			if (!(head & $has_next)) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				auto tail = $tail.index.load(std::memory_order_relaxed);
+
+				if ((head >> $shift) == (tail >> $shift)) {
+					break;
+				}
+
+				if ((head >> $shift) / $lap != (tail >> $shift) / $lap) {
+					new_head |= $has_next;
+				} else {
+					k = (tail >> $shift) % $lap - offset;
+				}
+			}
+			if (k > n - r) {
+				k = n - r;
+			}
+			new_head += k << $shift;
+
+			// The first block is not installed yet.
+			if (!block) {
+				bo.snooze();
+				head = $head.index.load(std::memory_order_acquire);
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (!$head.index.compare_exchange_weak(
+					head,
+					new_head,
+					std::memory_order_seq_cst,
+					std::memory_order_acquire)) {
+				block = $head.block.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (offset + k == $block_cap) {
+				auto next = block->wait_next();
+				auto next_index = (new_head & ~$has_next) + (1 << $shift);
+				if (next->next.load(std::memory_order_relaxed)) {
+					next_index |= $has_next;
+				}
+				$head.block.store(next, std::memory_order_release);
+				$head.index.store(next_index, std::memory_order_release);
+			}
+
+			// The block is freed only after all of its slots are read, so the
+			// slots left in this batch keep it alive.
+			for (auto i = offset; i < offset + k; ++i) {
+				auto &slot = block->slots[i];
+				slot.wait_write();
+				*out = std::move(slot.value());
+				++out;
+				destruct(slot.value());
+
+				if (i + 1 == $block_cap) {
+					$destroy(block, 0);
+				} else if (
+					slot.state.fetch_or($read, std::memory_order_acq_rel) &
+					$destroy_bit) {
+					$destroy(block, i + 1);
+				}
+			}
+			r += k;
+
+			head = $head.index.load(std::memory_order_acquire);
+			block = $head.block.load(std::memory_order_acquire);
+		}
+		return r;
+	}
+
+private:
+	static constexpr size_t $write = 1;
+	static constexpr size_t $read = 2;
+	static constexpr size_t $destroy_bit = 4;
+
+	static constexpr size_t $lap = 32;
+	static constexpr size_t $block_cap = $lap - 1;
+	static constexpr size_t $shift = 1;
+	static constexpr size_t $has_next = 1;
+
+	struct $slot_t {
+		alignas(alignof(T)) uchar sto[sizeof(T)];
+		std::atomic<size_t> state;
+
+		T &value() {
+			return *reinterpret_cast<T *>(&sto[0]);
+		}
+
+		void wait_write() {
+			_lockfree_backoff bo;
+			while (!(state.load(std::memory_order_acquire) & $write)) {
+				bo.snooze();
+			}
+		}
+	};
+
+	struct $block_t {
+		std::atomic<$block_t *> next;
+		$slot_t slots[$block_cap];
+
+		$block_t() : next(nullptr) {
+			for (auto &slot : slots) {
+				slot.state.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		$block_t *wait_next() {
+			_lockfree_backoff bo;
+			for (;;) {
+				auto n = next.load(std::memory_order_acquire);
+				if (n) {
+					return n;
+				}
+				bo.snooze();
+			}
+		}
+	};
+
+	struct $position_t {
+		std::atomic<size_t> index;
+		std::atomic<$block_t *> block;
+
+		constexpr $position_t() : index(0), block(nullptr) {}
+	};
+
+	$position_t $head;
+	uchar $padding[64];
+	$position_t $tail;
+
+	using $block_allocator_t = typename std::allocator_traits<
+		Allocator>::template rebind_alloc<$block_t>;
+
+	using $block_allocator_traits = std::allocator_traits<$block_allocator_t>;
+
+	static $block_t *$new_block() {
+		$block_allocator_t ba;
+		auto block = $block_allocator_traits::allocate(ba, 1);
+		construct(*block);
+		return block;
+	}
+
+	static void $delete_block($block_t *block) {
+		destruct(*block);
+		$block_allocator_t ba;
+		$block_allocator_traits::deallocate(ba, block, 1);
+	}
+
+	// Frees the block once every slot from start has been read.
+	// A reader still working on a slot takes over the job.
+	static void $destroy($block_t *block, size_t start) {
+		for (auto i = start; i < $block_cap - 1; ++i) {
+			auto &slot = block->slots[i];
+			if (!(slot.state.load(std::memory_order_acquire) & $read) &&
+				!(slot.state.fetch_or($destroy_bit, std::memory_order_acq_rel) &
+				  $read)) {
+				return;
+			}
+		}
+		$delete_block(block);
+	}
+};
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$write;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$read;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$destroy_bit;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$lap;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$block_cap;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$shift;
+
+template <typename T, typename Allocator>
+constexpr size_t lockfree_queue<T, Allocator>::$has_next;
+
+// Bounded MPMC queue on a ring of sequenced cells, it never allocates after
+// construction. The capacity is rounded up to a power of two.
+template <typename T>
+class bounded_lockfree_queue {
+public:
+	explicit bounded_lockfree_queue(size_t capacity) :
+		$cells(nullptr), $mask(0), $enq_pos(0), $deq_pos(0) {
+		size_t cap = 2;
+		while (cap < capacity) {
+			cap <<= 1;
+		}
+		$cells = new $cell_t[cap];
+		$mask = cap - 1;
+		for (size_t i = 0; i < cap; ++i) {
+			$cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bounded_lockfree_queue(const bounded_lockfree_queue &) = delete;
+
+	bounded_lockfree_queue &operator=(const bounded_lockfree_queue &) = delete;
+
+	~bounded_lockfree_queue() {
+		while (pop_front())
+			;
+		delete[] $cells;
+	}
+
+	size_t capacity() const {
+		return $mask + 1;
+	}
+
+	operator bool() const {
+		return !empty();
+	}
+
+	bool empty() const {
+		return $enq_pos.load() == $deq_pos.load();
+	}
+
+	// Returns false without touching the arguments when the queue is full.
+	template <typename... Args>
+	bool emplace_back(Args &&...args) {
+		auto pos = $enq_pos.load(std::memory_order_relaxed);
+		$cell_t *cell;
+		for (;;) {
+			cell = &$cells[pos & $mask];
+			auto seq = cell->seq.load(std::memory_order_acquire);
+			auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (dif == 0) {
+				if ($enq_pos.compare_exchange_weak(
+						pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = $enq_pos.load(std::memory_order_relaxed);
+			}
+		}
+		construct(cell->value(), std::forward<Args>(args)...);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	optional<T> pop_front() {
+		auto pos = $deq_pos.load(std::memory_order_relaxed);
+		$cell_t *cell;
+		for (;;) {
+			cell = &$cells[pos & $mask];
+			auto seq = cell->seq.load(std::memory_order_acquire);
+			auto dif =
+				static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (dif == 0) {
+				if ($deq_pos.compare_exchange_weak(
+						pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (dif < 0) {
+				return nullopt;
+			} else {
+				pos = $deq_pos.load(std::memory_order_relaxed);
+			}
+		}
+		optional<T> r(std::move(cell->value()));
+		destruct(cell->value());
+		cell->seq.store(pos + $mask + 1, std::memory_order_release);
+		return r;
+	}
+
+private:
+	struct $cell_t {
+		std::atomic<size_t> seq;
+		alignas(alignof(T)) uchar sto[sizeof(T)];
+
+		T &value() {
+			return *reinterpret_cast<T *>(&sto[0]);
+		}
+	};
+
+	$cell_t *$cells;
+	size_t $mask;
+	std::atomic<size_t> $enq_pos;
+	uchar $padding[64];
+	std::atomic<size_t> $deq_pos;
+};
+
+} // namespace rua
+
+#endif
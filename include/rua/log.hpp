@@ -100,8 +100,8 @@ inline void err_log(Args &&...args) {
 	p.println(std::forward<Args>(args)...);
 }
 
-inline chan<std::function<void()>> &_log_ch() {
-	static chan<std::function<void()>> ch;
+inline chan<move_only_function<void()>> &_log_ch() {
+	static chan<move_only_function<void()>> ch;
 	static thread log_td([]() {
 		for (;;) {
 			(**ch.recv())();
@@ -13,6 +13,7 @@
 
 #include <sys/mman.h>
 #include <sys/user.h>
+#include <unistd.h>
 
 #endif
 
@@ -83,6 +84,23 @@ mem_chmod(bytes_view data, int flags = mem_read | mem_write | mem_exec) {
 	return mem_chmod(data.data(), data.size(), flags);
 }
 
+inline size_t mem_page_size() {
+	static auto n = ([]() -> size_t {
+#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return si.dwPageSize;
+#else
+		auto n = sysconf(_SC_PAGESIZE);
+		if (n <= 0) {
+			return PAGE_SIZE;
+		}
+		return n;
+#endif
+	})();
+	return n;
+}
+
 } // namespace rua
 
 #endif
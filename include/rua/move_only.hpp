@@ -1,8 +1,11 @@
 #ifndef _rua_move_only_hpp
 #define _rua_move_only_hpp
 
+#include "invocable.hpp"
 #include "util.hpp"
 
+#include <cstddef>
+
 namespace rua {
 
 template <typename T>
@@ -37,11 +40,13 @@ public:
 		value().~T();
 	}
 
-	move_only(move_only &&src) {
+	move_only(move_only &&src) noexcept(
+		std::is_nothrow_move_constructible<T>::value) {
 		construct(value(), std::move(src.value()));
 	}
 
-	move_only(const move_only &src) :
+	move_only(const move_only &src) noexcept(
+		std::is_nothrow_move_constructible<T>::value) :
 		move_only(std::move(const_cast<move_only &>(src))) {}
 
 	RUA_OVERLOAD_ASSIGNMENT(move_only)
@@ -67,6 +72,150 @@ move_only<decay_t<T>> make_move_only(T &&val) {
 	return std::move(val);
 }
 
+template <typename Signature, size_t InlineSize = sizeof(void *) * 4>
+class move_only_function;
+
+/*
+	Like std::function, but it only needs the callable to be movable, and
+	any callable up to InlineSize bytes that is nothrow movable is stored
+	inline instead of on the heap.
+*/
+
+template <typename R, typename... Args, size_t InlineSize>
+class move_only_function<R(Args...), InlineSize> {
+public:
+	constexpr move_only_function() : $sto(), $vt(nullptr) {}
+
+	constexpr move_only_function(std::nullptr_t) : move_only_function() {}
+
+	template <
+		typename F,
+		typename FD = decay_t<F>,
+		typename = enable_if_t<
+			!std::is_base_of<move_only_function, FD>::value &&
+			std::is_convertible<invoke_result_t<FD &, Args &&...>, R>::
+				value>>
+	move_only_function(F &&f) : $vt(nullptr) {
+		if ($is_null(static_cast<const FD &>(f))) {
+			return;
+		}
+		$emplace<FD>(std::forward<F>(f));
+	}
+
+	~move_only_function() {
+		reset();
+	}
+
+	move_only_function(move_only_function &&src) noexcept : $vt(src.$vt) {
+		if (!$vt) {
+			return;
+		}
+		$vt->move(&$sto, &src.$sto);
+		src.$vt = nullptr;
+	}
+
+	RUA_OVERLOAD_ASSIGNMENT(move_only_function)
+
+	explicit operator bool() const {
+		return $vt;
+	}
+
+	R operator()(Args... args) const {
+		assert($vt);
+		return $vt->invoke(
+			const_cast<$storage_t *>(&$sto), std::forward<Args>(args)...);
+	}
+
+	void reset() {
+		if (!$vt) {
+			return;
+		}
+		$vt->destroy(&$sto);
+		$vt = nullptr;
+	}
+
+private:
+	struct $storage_t {
+		alignas(alignof(max_align_t)) uchar buf[
+			InlineSize < sizeof(void *) ? sizeof(void *) : InlineSize];
+	};
+
+	struct $vtable_t {
+		R (*invoke)($storage_t *, Args &&...);
+		void (*move)($storage_t *dst, $storage_t *src);
+		void (*destroy)($storage_t *);
+	};
+
+	$storage_t $sto;
+	const $vtable_t *$vt;
+
+	template <typename F>
+	static bool $is_null(const F &) {
+		return false;
+	}
+
+	template <typename F>
+	static bool $is_null(F *f) {
+		return !f;
+	}
+
+	template <typename Base, typename Mbr>
+	static bool $is_null(Mbr Base::*mbr_ptr) {
+		return !mbr_ptr;
+	}
+
+	template <typename Sig>
+	static bool $is_null(const std::function<Sig> &f) {
+		return !f;
+	}
+
+	template <typename Sig, size_t Sz>
+	static bool $is_null(const move_only_function<Sig, Sz> &f) {
+		return !f;
+	}
+
+	template <typename F>
+	struct $is_inline
+		: bool_constant<
+			  sizeof(F) <= sizeof($storage_t) &&
+			  alignof(F) <= alignof($storage_t) &&
+			  std::is_nothrow_move_constructible<F>::value> {};
+
+	template <typename F, typename... FArgs>
+	enable_if_t<$is_inline<F>::value> $emplace(FArgs &&...f_args) {
+		construct(
+			*reinterpret_cast<F *>(&$sto), std::forward<FArgs>(f_args)...);
+		static const $vtable_t vt{
+			[]($storage_t *sto, Args &&...args) -> R {
+				return static_cast<R>(rua::invoke(
+					*reinterpret_cast<F *>(sto), std::forward<Args>(args)...));
+			},
+			[]($storage_t *dst, $storage_t *src) {
+				auto &src_f = *reinterpret_cast<F *>(src);
+				construct(*reinterpret_cast<F *>(dst), std::move(src_f));
+				destruct(src_f);
+			},
+			[]($storage_t *sto) { destruct(*reinterpret_cast<F *>(sto)); }};
+		$vt = &vt;
+	}
+
+	template <typename F, typename... FArgs>
+	enable_if_t<!$is_inline<F>::value> $emplace(FArgs &&...f_args) {
+		*reinterpret_cast<F **>(&$sto) = new F(std::forward<FArgs>(f_args)...);
+		static const $vtable_t vt{
+			[]($storage_t *sto, Args &&...args) -> R {
+				return static_cast<R>(rua::invoke(
+					**reinterpret_cast<F **>(sto),
+					std::forward<Args>(args)...));
+			},
+			[]($storage_t *dst, $storage_t *src) {
+				*reinterpret_cast<F **>(dst) = *reinterpret_cast<F **>(src);
+			},
+			[]($storage_t *sto) { delete *reinterpret_cast<F **>(sto); }};
+		$vt = &vt;
+	}
+};
+
 } // namespace rua
 
 #endif
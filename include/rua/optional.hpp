@@ -253,4 +253,26 @@ public:
 
 #endif
 
+namespace rua {
+
+// The ones of std::optional are ambiguous for a derived class, so these also
+// serve the one derived from std::optional.
+
+template <typename T>
+inline decltype(std::declval<const T &>() == std::declval<const T &>(), bool())
+operator==(const optional<T> &a, const optional<T> &b) {
+	if (a.has_value() != b.has_value()) {
+		return false;
+	}
+	return !a.has_value() || a.value() == b.value();
+}
+
+template <typename T>
+inline decltype(std::declval<const T &>() == std::declval<const T &>(), bool())
+operator!=(const optional<T> &a, const optional<T> &b) {
+	return !(a == b);
+}
+
+} // namespace rua
+
 #endif
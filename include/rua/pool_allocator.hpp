@@ -0,0 +1,190 @@
+#ifndef _rua_pool_allocator_hpp
+#define _rua_pool_allocator_hpp
+
+#include "lockfree_queue.hpp"
+#include "thread/var.hpp"
+#include "util.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace rua {
+
+/*
+	Every thread keeps its own free list for each block size, so recycling a
+	block never takes a lock.
+
+	A thread that frees more than it allocates (e.g. the receiving side of a
+	chan) hands batches of its free list over to a shared lock-free depot,
+	where the allocating side picks them up again.
+*/
+
+template <typename T>
+class pool_allocator;
+
+template <size_t Size>
+class _pool {
+public:
+	static void *alloc() {
+		auto c = $cache();
+		if (!c) {
+			return ::operator new(Size);
+		}
+		if (!c->front) {
+			auto batch_opt = $depot().pop_front();
+			if (!batch_opt) {
+				return ::operator new(Size);
+			}
+			auto batch = *batch_opt;
+
+			// The depot may have freed one of its blocks into this cache.
+			if (c->front) {
+				auto back = batch;
+				while (back->after) {
+					back = back->after;
+				}
+				back->after = c->front;
+			}
+			c->front = batch;
+			c->n += $batch_sz;
+		}
+		auto n = c->front;
+		c->front = n->after;
+		--c->n;
+		return n;
+	}
+
+	static void dealloc(void *ptr) {
+		auto c = $cache();
+		if (!c) {
+			::operator delete(ptr);
+			return;
+		}
+		if (c->n == $batch_sz * 2) {
+			auto batch = c->front;
+			auto back = batch;
+			for (size_t i = 1; i < $batch_sz; ++i) {
+				back = back->after;
+			}
+			c->front = back->after;
+			c->n -= $batch_sz;
+			back->after = nullptr;
+			$depot().emplace_back(batch);
+		}
+		auto n = reinterpret_cast<$node_t *>(ptr);
+		n->after = c->front;
+		c->front = n;
+		++c->n;
+	}
+
+private:
+	static constexpr size_t $batch_sz = 16;
+
+	struct $node_t {
+		$node_t *after;
+	};
+
+	struct $cache_t {
+		$node_t *front;
+		size_t n;
+	};
+
+	using $depot_t = lockfree_queue<$node_t *, pool_allocator<$node_t *>>;
+
+	// Intentionally leaked, blocks may still be freed during static
+	// destruction.
+	// Its own blocks come from the pools as well, so it is reentered from
+	// alloc() and dealloc(), which keep the cache consistent around it.
+	static $depot_t &$depot() {
+		static auto inst = new $depot_t;
+		return *inst;
+	}
+
+	static $cache_t *$cache() {
+		static auto wv = new thread_word_var([](any_word val) {
+			if (!val) {
+				return;
+			}
+			auto c = val.as<$cache_t *>();
+			auto n = c->front;
+			while (n) {
+				auto after = n->after;
+				::operator delete(n);
+				n = after;
+			}
+			delete c;
+		});
+		if (!wv->is_storable()) {
+			return nullptr;
+		}
+		auto c = wv->get().template as<$cache_t *>();
+		if (!c) {
+			c = new $cache_t{nullptr, 0};
+			wv->set(c);
+		}
+		return c;
+	}
+};
+
+template <size_t Size>
+constexpr size_t _pool<Size>::$batch_sz;
+
+// A stateless allocator that recycles single objects through _pool, arrays
+// and over-aligned types go to std::allocator.
+template <typename T>
+class pool_allocator {
+public:
+	using value_type = T;
+
+	constexpr pool_allocator() = default;
+
+	template <typename U>
+	constexpr pool_allocator(const pool_allocator<U> &) {}
+
+	T *allocate(size_t n) {
+		if (n != 1 || !$is_poolable) {
+			return std::allocator<T>().allocate(n);
+		}
+		return reinterpret_cast<T *>(_pool<$size>::alloc());
+	}
+
+	void deallocate(T *ptr, size_t n) {
+		if (n != 1 || !$is_poolable) {
+			std::allocator<T>().deallocate(ptr, n);
+			return;
+		}
+		_pool<$size>::dealloc(ptr);
+	}
+
+	template <typename U>
+	constexpr bool operator==(const pool_allocator<U> &) const {
+		return true;
+	}
+
+	template <typename U>
+	constexpr bool operator!=(const pool_allocator<U> &) const {
+		return false;
+	}
+
+private:
+	static constexpr size_t $align = alignof(std::max_align_t);
+
+	static constexpr bool $is_poolable = alignof(T) <= $align;
+
+	// Rounded up so that types of similar sizes share a pool.
+	static constexpr size_t $size = (sizeof(T) + $align - 1) / $align * $align;
+};
+
+template <typename T>
+constexpr size_t pool_allocator<T>::$align;
+
+template <typename T>
+constexpr bool pool_allocator<T>::$is_poolable;
+
+template <typename T>
+constexpr size_t pool_allocator<T>::$size;
+
+} // namespace rua
+
+#endif
@@ -11,15 +11,20 @@
 #include "../conc/future.hpp"
 #include "../conc/then.hpp"
 #include "../conc/wait.hpp"
+#include "../sys/wait.hpp"
+#include "../thread/parallel.hpp"
 #include "../util.hpp"
 
 #include <limits.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <cerrno>
+
 #include <vector>
 
 namespace rua { namespace posix {
@@ -81,16 +86,30 @@ public:
 		return $id >= 0;
 	}
 
+	// Watches a pidfd on the default_reactor() instead of blocking a thread
+	// in waitpid(), on Linux 5.3 and later.
 	future<int> RUA_OPERATOR_AWAIT() const {
-		if (!$id) {
+		if ($id <= 0) {
 			return 0;
 		}
 		auto id = $id;
-		return parallel([id]() -> any_word {
-			int status;
-			waitpid(id, &status, 0);
-			return WIFEXITED(status) ? 0 : WEXITSTATUS(status);
-		});
+#if defined(RUA_LINUX) && defined(SYS_pidfd_open)
+		auto pidfd = static_cast<int>(::syscall(SYS_pidfd_open, id, 0));
+		if (pidfd >= 0) {
+			auto wt = sys_wait(pidfd);
+			if (!wt.await_ready()) {
+				return std::move(wt) >> [id, pidfd]() -> int {
+					::close(pidfd);
+					return $wait(id);
+				};
+			}
+			::close(pidfd);
+			if (wt.await_resume()) {
+				return $wait(id);
+			}
+		}
+#endif
+		return parallel_blocking([id]() -> int { return $wait(id); });
 	}
 
 	void kill() {
@@ -145,6 +164,17 @@ public:
 
 private:
 	::pid_t $id;
+
+	// Returns -1 when it was not exited normally.
+	static int $wait(pid_t id) {
+		int status;
+		while (waitpid(id, &status, 0) < 0) {
+			if (errno != EINTR) {
+				return -1;
+			}
+		}
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	}
 };
 
 namespace _this_process {
@@ -209,7 +239,8 @@ public:
 		}
 
 		if (!$info.stderr_w && $info.stdout_w) {
-			$info.stderr_w = $info.stdout_w;
+			$info.stderr_w.emplace(
+				sys_stream($info.stdout_w->native_handle(), false));
 		}
 
 		auto id = ::fork();
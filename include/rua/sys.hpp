@@ -4,6 +4,7 @@
 #include "sys/info.hpp"
 #include "sys/listen.hpp"
 #include "sys/paths.hpp"
+#include "sys/reactor.hpp"
 #include "sys/stream.hpp"
 #include "sys/wait.hpp"
 
@@ -13,6 +13,16 @@ using namespace win32::_sys_listen;
 
 } // namespace rua
 
+#elif defined(RUA_LINUX)
+
+#include "listen/posix.hpp"
+
+namespace rua {
+
+using namespace posix::_sys_listen;
+
+} // namespace rua
+
 #endif
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef _rua_sys_listen_posix_hpp
+#define _rua_sys_listen_posix_hpp
+
+#include "../reactor.hpp"
+
+#include "../../error.hpp"
+#include "../../util.hpp"
+
+#include <poll.h>
+
+#include <cassert>
+#include <functional>
+
+namespace rua { namespace posix {
+
+RUA_CVAR strv_error err_sys_listen_failed("failed to listen fd");
+
+inline bool _sys_is_readable(int fd) {
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return ::poll(&pfd, 1, 0) > 0;
+}
+
+// Fails if fd can not be watched, such as an fd that is already watched.
+inline expected<> _sys_listen_force(int fd, std::function<void()> callback) {
+	assert(fd >= 0);
+
+	if (!default_reactor().listen(fd, std::move(callback))) {
+		return err_sys_listen_failed;
+	}
+	return expected<>();
+}
+
+namespace _sys_listen {
+
+// Calls callback once fd becomes readable, fd must be kept open until then.
+// The callback is dropped if fd can not be watched.
+inline expected<> sys_listen(int fd, std::function<void()> callback) {
+	assert(fd >= 0);
+
+	if (_sys_is_readable(fd)) {
+		callback();
+		return expected<>();
+	}
+	return _sys_listen_force(fd, std::move(callback));
+}
+
+} // namespace _sys_listen
+
+using namespace _sys_listen;
+
+}} // namespace rua::posix
+
+#endif
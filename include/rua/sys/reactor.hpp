@@ -0,0 +1,24 @@
+#ifndef _rua_sys_reactor_hpp
+#define _rua_sys_reactor_hpp
+
+#include "../util/macros.hpp"
+
+#ifdef RUA_LINUX
+
+#include "reactor/epoll.hpp"
+
+namespace rua {
+
+using reactor = epoll::reactor;
+
+// Intentionally leaked, its thread never exits.
+inline reactor &default_reactor() {
+	static auto inst = new reactor;
+	return *inst;
+}
+
+} // namespace rua
+
+#endif
+
+#endif
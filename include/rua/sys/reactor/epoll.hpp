@@ -0,0 +1,366 @@
+#ifndef _rua_sys_reactor_epoll_hpp
+#define _rua_sys_reactor_epoll_hpp
+
+#include "../../binary/bytes.hpp"
+#include "../../conc/future.hpp"
+#include "../../conc/promise.hpp"
+#include "../../move_only.hpp"
+#include "../../thread/core.hpp"
+#include "../../thread/parallel.hpp"
+#include "../../thread/wait.hpp"
+#include "../../util.hpp"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace rua { namespace epoll {
+
+/*
+	Watches the attached fds with edge-triggered epoll on a thread of its own
+	and posts the operations they become ready for to the default_executor(),
+	so a few threads serve any number of pipes and sockets.
+
+	An operation is tried on the calling thread first, it only waits for the
+	fd when the fd would block.
+
+	Only one read and one write can be pending on an fd at a time.
+*/
+
+class reactor {
+private:
+	struct $dir_t {
+		bool is_ready;
+		move_only_function<void()> wtr;
+
+		$dir_t() : is_ready(false) {}
+	};
+
+public:
+	class entry {
+	public:
+		int fd() const {
+			return $fd;
+		}
+
+	private:
+		std::mutex $mtx;
+		int $fd;
+
+		// Counts the attachments, so the operations posted for a previous
+		// one fail instead of touching the fd of the current one.
+		size_t $gen;
+
+		$dir_t $rd, $wr;
+
+		entry() : $fd(-1), $gen(0) {}
+
+		friend reactor;
+	};
+
+	reactor() :
+		$epfd(epoll_create1(EPOLL_CLOEXEC)),
+		$evfd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+		$exiting(false) {
+		assert($epfd >= 0);
+		assert($evfd >= 0);
+
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		epoll_ctl($epfd, EPOLL_CTL_ADD, $evfd, &ev);
+
+		$thrd = thread([this]() { $run(); });
+	}
+
+	~reactor() {
+		$exiting.store(true);
+		$notify();
+		wait($thrd);
+
+		::close($evfd);
+		::close($epfd);
+
+		for (auto ent : $idle_ents) {
+			delete ent;
+		}
+	}
+
+	reactor(const reactor &) = delete;
+
+	reactor &operator=(const reactor &) = delete;
+
+	// Puts fd in non-blocking mode, which is shared with its duplicates.
+	// Returns nullptr on failure.
+	entry *attach(int fd) {
+		auto flags = fcntl(fd, F_GETFL);
+		if (flags < 0 ||
+			(!(flags & O_NONBLOCK) &&
+			 fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+			return nullptr;
+		}
+
+		auto ent = $new_entry();
+		{
+			std::lock_guard<std::mutex> lg(ent->$mtx);
+			ent->$fd = fd;
+			ent->$rd.is_ready = false;
+			ent->$wr.is_ready = false;
+		}
+
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = ent;
+		if (epoll_ctl($epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			$drop_entry(ent);
+			fcntl(fd, F_SETFL, flags);
+			return nullptr;
+		}
+		return ent;
+	}
+
+	// Fails the pending operations, call it before closing the fd.
+	void detach(entry *ent) {
+		assert(ent);
+
+		move_only_function<void()> rd_wtr, wr_wtr;
+		{
+			std::lock_guard<std::mutex> lg(ent->$mtx);
+			epoll_ctl($epfd, EPOLL_CTL_DEL, ent->$fd, nullptr);
+			ent->$fd = -1;
+			++ent->$gen;
+			rd_wtr = exchange(ent->$rd.wtr, nullptr);
+			wr_wtr = exchange(ent->$wr.wtr, nullptr);
+		}
+		if (rd_wtr) {
+			rd_wtr();
+		}
+		if (wr_wtr) {
+			wr_wtr();
+		}
+
+		// A late event may still point to it, which only costs a retry.
+		std::lock_guard<std::mutex> lg($idle_mtx);
+		$idle_ents.emplace_back(ent);
+	}
+
+	// Posts callback once when fd becomes readable (e.g. a pidfd, an eventfd
+	// or a signalfd), without reading it. Returns false on failure.
+	bool listen(int fd, std::function<void()> callback) {
+		assert(callback);
+
+		auto ent = $new_entry();
+		{
+			std::lock_guard<std::mutex> lg(ent->$mtx);
+			ent->$fd = fd;
+			ent->$rd.is_ready = false;
+			ent->$wr.is_ready = false;
+			ent->$rd.wtr = [this, ent, callback]() {
+				detach(ent);
+				callback();
+			};
+		}
+
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = ent;
+		if (epoll_ctl($epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			{
+				std::lock_guard<std::mutex> lg(ent->$mtx);
+				ent->$rd.wtr = nullptr;
+			}
+			$drop_entry(ent);
+			return false;
+		}
+		return true;
+	}
+
+	// Resolves to the number of bytes, or to -errno on failure (-EBADF once
+	// detached), as errno of the thread that ran the operation is not the
+	// caller's.
+
+	future<ssize_t> async_read(entry &ent, bytes_ref buf) {
+		return $submit(ent, &entry::$rd, [buf](int fd) mutable -> ssize_t {
+			return ::read(fd, buf.data(), buf.size());
+		});
+	}
+
+	future<ssize_t> async_write(entry &ent, bytes_view data) {
+		return $submit(ent, &entry::$wr, [data](int fd) -> ssize_t {
+			return ::write(fd, data.data(), data.size());
+		});
+	}
+
+private:
+	int $epfd, $evfd;
+	std::atomic<bool> $exiting;
+	std::mutex $idle_mtx;
+	std::vector<entry *> $idle_ents;
+	thread $thrd;
+
+	entry *$new_entry() {
+		{
+			std::lock_guard<std::mutex> lg($idle_mtx);
+			if ($idle_ents.size()) {
+				auto ent = $idle_ents.back();
+				$idle_ents.pop_back();
+				return ent;
+			}
+		}
+		return new entry;
+	}
+
+	template <typename Op>
+	future<ssize_t> $submit(entry &ent, $dir_t entry::*dir, Op op) {
+		size_t gen;
+		{
+			std::lock_guard<std::mutex> lg(ent.$mtx);
+			gen = ent.$gen;
+		}
+		promise<ssize_t> *prm = nullptr;
+		ssize_t n;
+		if ($attempt(ent, dir, gen, op, prm, n)) {
+			return n;
+		}
+		return *prm;
+	}
+
+	// Returns false when the fd would block, then prm is created if it is
+	// not yet, and is fulfilled once the operation is done.
+	template <typename Op>
+	bool $attempt(
+		entry &ent,
+		$dir_t entry::*dir,
+		size_t gen,
+		Op &op,
+		promise<ssize_t> *&prm,
+		ssize_t &n) {
+		for (;;) {
+			int fd;
+			{
+				std::lock_guard<std::mutex> lg(ent.$mtx);
+				if (ent.$gen != gen) {
+					n = -EBADF;
+					return true;
+				}
+				fd = ent.$fd;
+				(ent.*dir).is_ready = false;
+			}
+
+			n = op(fd);
+			if (n >= 0) {
+				return true;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				n = -errno;
+				return true;
+			}
+
+			std::lock_guard<std::mutex> lg(ent.$mtx);
+			if (ent.$gen != gen) {
+				n = -EBADF;
+				return true;
+			}
+			// Became ready meanwhile.
+			if ((ent.*dir).is_ready) {
+				continue;
+			}
+			assert(!(ent.*dir).wtr);
+			if (!prm) {
+				prm = new newable_promise<ssize_t>;
+			}
+			auto p = prm;
+			auto ent_ptr = &ent;
+			(ent.*dir).wtr = [this, ent_ptr, dir, gen, op, p]() mutable {
+				promise<ssize_t> *prm = p;
+				ssize_t n;
+				if ($attempt(*ent_ptr, dir, gen, op, prm, n)) {
+					prm->fulfill(n);
+				}
+			};
+			return false;
+		}
+	}
+
+	// Detaches an entry that failed to be added, without removing the fd
+	// that may be watched by another entry (EEXIST).
+	void $drop_entry(entry *ent) {
+		{
+			std::lock_guard<std::mutex> lg(ent->$mtx);
+			ent->$fd = -1;
+		}
+		detach(ent);
+	}
+
+	void $notify() {
+		uint64_t v = 1;
+		auto r = ::write($evfd, &v, sizeof(v));
+		(void)r;
+	}
+
+	void $run() {
+		static constexpr int max_evs = 64;
+		epoll_event evs[max_evs];
+
+		for (;;) {
+			auto n = epoll_wait($epfd, evs, max_evs, -1);
+			if (n < 0) {
+				assert(errno == EINTR);
+				continue;
+			}
+			for (int i = 0; i < n; ++i) {
+				auto ent = reinterpret_cast<entry *>(evs[i].data.ptr);
+				if (!ent) {
+					uint64_t v;
+					auto r = ::read($evfd, &v, sizeof(v));
+					(void)r;
+					if ($exiting.load()) {
+						return;
+					}
+					continue;
+				}
+
+				auto e = evs[i].events;
+				move_only_function<void()> rd_wtr, wr_wtr;
+				{
+					std::lock_guard<std::mutex> lg(ent->$mtx);
+					if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+						if (ent->$rd.wtr) {
+							rd_wtr = exchange(ent->$rd.wtr, nullptr);
+						} else {
+							ent->$rd.is_ready = true;
+						}
+					}
+					if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+						if (ent->$wr.wtr) {
+							wr_wtr = exchange(ent->$wr.wtr, nullptr);
+						} else {
+							ent->$wr.is_ready = true;
+						}
+					}
+				}
+				if (rd_wtr) {
+					_parallel(std::move(rd_wtr));
+				}
+				if (wr_wtr) {
+					_parallel(std::move(wr_wtr));
+				}
+			}
+		}
+	}
+};
+
+}} // namespace rua::epoll
+
+#endif
@@ -4,9 +4,16 @@
 #include "../../io/util.hpp"
 #include "../../util.hpp"
 
+#ifdef RUA_LINUX
+#include "../reactor.hpp"
+#endif
+
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <cassert>
+#include <cerrno>
 
 namespace rua { namespace posix {
 
@@ -15,7 +22,14 @@ public:
 	using native_handle_t = int;
 
 	constexpr sys_stream(native_handle_t fd = -1, bool need_close = true) :
-		$fd(fd), $nc($fd >= 0 ? need_close : false) {}
+		$fd(fd),
+		$nc($fd >= 0 ? need_close : false)
+#ifdef RUA_LINUX
+		,
+		$ent(nullptr)
+#endif
+	{
+	}
 
 	template <
 		typename NullPtr,
@@ -23,6 +37,9 @@ public:
 	constexpr sys_stream(NullPtr) : sys_stream() {}
 
 	sys_stream(const sys_stream &src) {
+#ifdef RUA_LINUX
+		$ent = nullptr;
+#endif
 		if (!src.$fd) {
 			$fd = -1;
 			return;
@@ -38,6 +55,9 @@ public:
 	}
 
 	sys_stream(sys_stream &&src) : sys_stream(src.$fd, src.$nc) {
+#ifdef RUA_LINUX
+		$ent = exchange(src.$ent, nullptr);
+#endif
 		src.detach();
 	}
 
@@ -62,15 +82,47 @@ public:
 	virtual ssize_t read(bytes_ref buf) {
 		assert(*this);
 
-		return $read($fd, buf);
+		return $poll_until_done(
+			POLLIN, [this, buf]() { return $read($fd, buf); });
 	}
 
 	virtual ssize_t write(bytes_view data) {
 		assert(*this);
 
-		return $write($fd, data);
+		return $poll_until_done(
+			POLLOUT, [this, data]() { return $write($fd, data); });
+	}
+
+#ifdef RUA_LINUX
+
+	// The first call attaches the fd to the default_reactor(), which puts it
+	// in non-blocking mode. The mode is shared with the duplicates of the fd,
+	// so read() and write() of any stream keep blocking by polling a
+	// non-blocking fd.
+
+	// Resolve to the number of bytes, or to -errno on failure, since the
+	// operation may fail on another thread.
+
+	future<ssize_t> async_read(bytes_ref buf) {
+		assert(*this);
+
+		if (!$attach()) {
+			return $neg_errno($read($fd, buf));
+		}
+		return default_reactor().async_read(*$ent, buf);
+	}
+
+	future<ssize_t> async_write(bytes_view data) {
+		assert(*this);
+
+		if (!$attach()) {
+			return $neg_errno($write($fd, data));
+		}
+		return default_reactor().async_write(*$ent, data);
 	}
 
+#endif
+
 	bool is_need_close() const {
 		return $fd >= 0 && $nc;
 	}
@@ -79,6 +131,11 @@ public:
 		if ($fd < 0) {
 			return;
 		}
+#ifdef RUA_LINUX
+		if ($ent) {
+			default_reactor().detach(exchange($ent, nullptr));
+		}
+#endif
 		if ($nc) {
 			::close($fd);
 		}
@@ -100,6 +157,58 @@ private:
 	int $fd;
 	bool $nc;
 
+#ifdef RUA_LINUX
+	reactor::entry *$ent;
+
+	static ssize_t $neg_errno(ssize_t n) {
+		return n < 0 ? -errno : n;
+	}
+
+	bool $attach() {
+		if (!$ent) {
+			$ent = default_reactor().attach($fd);
+		}
+		return $ent;
+	}
+
+#endif
+
+	// Blocks the calling thread rather than waiting for the reactor, whose
+	// completions run on the default_executor(), which may be the caller.
+	template <typename Op>
+	ssize_t $poll_until_done(short events, Op op) {
+		for (;;) {
+			auto n = op();
+			if (n >= 0) {
+				return n;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+				!$is_nonblocking()) {
+				return n;
+			}
+
+			pollfd pfd;
+			pfd.fd = $fd;
+			pfd.events = events;
+			pfd.revents = 0;
+			if (::poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				return -1;
+			}
+		}
+	}
+
+	// Only the would-block errors of a non-blocking fd are waited for, the
+	// ones of a timeout set on a socket are not.
+	bool $is_nonblocking() const {
+		auto eno = errno;
+		auto flags = fcntl($fd, F_GETFL);
+		errno = eno;
+		return flags >= 0 && (flags & O_NONBLOCK);
+	}
+
 	static ssize_t $read(int $fd, bytes_ref p) {
 		return static_cast<ssize_t>(::read($fd, p.data(), p.size()));
 	}
@@ -13,6 +13,16 @@ using namespace win32::_sys_wait;
 
 } // namespace rua
 
+#elif defined(RUA_LINUX)
+
+#include "wait/posix.hpp"
+
+namespace rua {
+
+using namespace posix::_sys_wait;
+
+} // namespace rua
+
 #endif
 
 #endif
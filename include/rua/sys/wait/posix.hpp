@@ -0,0 +1,38 @@
+#ifndef _rua_sys_wait_posix_hpp
+#define _rua_sys_wait_posix_hpp
+
+#include "../../conc/future.hpp"
+#include "../../conc/promise.hpp"
+
+#include "../listen/posix.hpp"
+
+namespace rua { namespace posix {
+
+namespace _sys_wait {
+
+// Waits for fd to become readable, such as a pidfd whose process exited,
+// an eventfd that was written or a signalfd with a pending signal, without
+// blocking a thread for it. The fd is not read.
+inline future<> sys_wait(int fd) {
+	assert(fd >= 0);
+
+	if (_sys_is_readable(fd)) {
+		return expected<>();
+	}
+
+	auto prm = new newable_promise<>;
+	auto lsn = _sys_listen_force(fd, [prm]() mutable { prm->fulfill(); });
+	if (!lsn) {
+		prm->unuse();
+		return lsn;
+	}
+	return *prm;
+}
+
+} // namespace _sys_wait
+
+using namespace _sys_wait;
+
+}} // namespace rua::posix
+
+#endif
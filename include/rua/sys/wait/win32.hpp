@@ -13,14 +13,12 @@ namespace _sys_wait {
 inline future<> sys_wait(HANDLE handle) {
 	assert(handle);
 
-	future<> r;
-
 	if (WaitForSingleObject(handle, 0) != WAIT_TIMEOUT) {
-		return r;
+		return expected<>();
 	}
 
 	auto prm = new newable_promise<>;
-	r = *prm;
+	future<> r(*prm);
 
 	_sys_listen_force(handle, [prm]() mutable { prm->fulfill(); });
 
@@ -3,8 +3,10 @@
 
 #include "thread/core.hpp"
 #include "thread/dozer.hpp"
+#include "thread/executor.hpp"
 #include "thread/id.hpp"
 #include "thread/parallel.hpp"
+#include "thread/parker.hpp"
 #include "thread/sleep.hpp"
 #include "thread/var.hpp"
 #include "thread/wait.hpp"
@@ -114,19 +114,25 @@ private:
 		pthread_t id;
 		pthread_attr_t attr;
 		std::function<void()> fn;
+		bool is_joined;
 
-		$res_t() = default;
+		$res_t() : is_joined(false) {}
 
 		~$res_t() {
 			if (!id) {
 				return;
 			}
-			pthread_detach(id);
+			if (!is_joined) {
+				pthread_detach(id);
+			}
 			pthread_attr_destroy(&attr);
 		}
 
 		$res_t($res_t &&src) :
-			id(src.id), attr(src.attr), fn(std::move(src.fn)) {
+			id(src.id),
+			attr(src.attr),
+			fn(std::move(src.fn)),
+			is_joined(src.is_joined) {
 			if (src.id) {
 				src.id = 0;
 			}
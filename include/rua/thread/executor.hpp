@@ -0,0 +1,433 @@
+#ifndef _rua_thread_executor_hpp
+#define _rua_thread_executor_hpp
+
+#include "core.hpp"
+#include "dozer.hpp"
+#include "var.hpp"
+
+#include "../hard.hpp"
+#include "../lockfree_queue.hpp"
+#include "../move_only.hpp"
+#include "../pool_allocator.hpp"
+#include "../util.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rua {
+
+/*
+	Reference from
+		https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+
+	The owner pushes and takes at the bottom, thieves steal from the top.
+	Replaced arrays are kept until destruction, a thief may still read them.
+*/
+
+template <typename T>
+class _work_stealing_deque {
+public:
+	_work_stealing_deque() : $top(0), $bottom(0), $arr(new $array_t(64)) {
+		$old_arrs.emplace_back($arr.load());
+	}
+
+	_work_stealing_deque(const _work_stealing_deque &) = delete;
+
+	_work_stealing_deque &operator=(const _work_stealing_deque &) = delete;
+
+	~_work_stealing_deque() {
+		for (auto arr : $old_arrs) {
+			delete arr;
+		}
+	}
+
+	// Only called by the owner.
+	void push(T *val) {
+		auto b = $bottom.load(std::memory_order_relaxed);
+		auto t = $top.load(std::memory_order_acquire);
+		auto arr = $arr.load(std::memory_order_relaxed);
+		if (b - t > static_cast<ptrdiff_t>(arr->mask)) {
+			arr = $grow(arr, t, b);
+		}
+		arr->at(b).store(val, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		$bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	// Only called by the owner.
+	T *take() {
+		auto b = $bottom.load(std::memory_order_relaxed) - 1;
+		auto arr = $arr.load(std::memory_order_relaxed);
+		$bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto t = $top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			$bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		auto val = arr->at(b).load(std::memory_order_relaxed);
+		if (t < b) {
+			return val;
+		}
+
+		// The last one, race with the thieves.
+		if (!$top.compare_exchange_strong(
+				t,
+				t + 1,
+				std::memory_order_seq_cst,
+				std::memory_order_relaxed)) {
+			val = nullptr;
+		}
+		$bottom.store(b + 1, std::memory_order_relaxed);
+		return val;
+	}
+
+	T *steal() {
+		auto t = $top.load(std::memory_order_acquire);
+		for (;;) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			auto b = $bottom.load(std::memory_order_acquire);
+			if (t >= b) {
+				return nullptr;
+			}
+			auto val = $arr.load(std::memory_order_acquire)
+						   ->at(t)
+						   .load(std::memory_order_relaxed);
+			if ($top.compare_exchange_strong(
+					t,
+					t + 1,
+					std::memory_order_seq_cst,
+					std::memory_order_acquire)) {
+				return val;
+			}
+		}
+	}
+
+private:
+	struct $array_t {
+		size_t mask;
+		std::unique_ptr<std::atomic<T *>[]> buf;
+
+		explicit $array_t(size_t cap) :
+			mask(cap - 1), buf(new std::atomic<T *>[cap]) {}
+
+		std::atomic<T *> &at(ptrdiff_t ix) {
+			return buf[static_cast<size_t>(ix) & mask];
+		}
+	};
+
+	std::atomic<ptrdiff_t> $top;
+	uchar $padding[64];
+	std::atomic<ptrdiff_t> $bottom;
+	std::atomic<$array_t *> $arr;
+	std::vector<$array_t *> $old_arrs;
+
+	$array_t *$grow($array_t *arr, ptrdiff_t t, ptrdiff_t b) {
+		auto new_arr = new $array_t((arr->mask + 1) * 2);
+		for (auto i = t; i < b; ++i) {
+			new_arr->at(i).store(
+				arr->at(i).load(std::memory_order_relaxed),
+				std::memory_order_relaxed);
+		}
+		$old_arrs.emplace_back(new_arr);
+		$arr.store(new_arr, std::memory_order_release);
+		return new_arr;
+	}
+};
+
+/*
+	A fixed set of workers, each with its own deque of tasks.
+
+	Tasks posted from a worker go to the bottom of its own deque, the others
+	go to a shared injection queue. Idle workers steal from the top of the
+	other deques before they doze off.
+
+	shutdown() stops accepting tasks, lets the workers drain every task that
+	was already accepted (including the ones they post meanwhile), and waits
+	for them to exit. When it is called from
+	one of its own workers it does not wait.
+
+	Tasks must not block for long, use parallel_blocking() for that.
+*/
+
+class executor {
+public:
+	explicit executor(size_t num_workers = 0) :
+		$state(0), $exiting(false), $num_idle(0) {
+		if (!num_workers) {
+			num_workers = num_cpus();
+			if (!num_workers) {
+				num_workers = 1;
+			}
+		}
+		$alive = num_workers;
+		$wkrs.reserve(num_workers);
+		for (size_t i = 0; i < num_workers; ++i) {
+			$wkrs.emplace_back(new $worker_t(*this, i));
+		}
+		for (auto &wkr : $wkrs) {
+			auto wkr_ptr = wkr.get();
+			thread([wkr_ptr]() { wkr_ptr->owner.$run(*wkr_ptr); });
+		}
+	}
+
+	executor(const executor &) = delete;
+
+	executor &operator=(const executor &) = delete;
+
+	~executor() {
+		shutdown();
+	}
+
+	size_t size() const {
+		return $wkrs.size();
+	}
+
+	// Returns false without touching the task after shutdown() is called,
+	// except for the tasks posted from its own workers, which are drained.
+	bool post(move_only_function<void()> &&task) {
+		auto wkr = $this_worker();
+		if (wkr && &wkr->owner == this) {
+			wkr->deq.push($new_task(std::move(task)));
+			$notify_one();
+			return true;
+		}
+
+		if ($state.fetch_add(2) & 1) {
+			$state -= 2;
+			return false;
+		}
+		$injection.emplace_back($new_task(std::move(task)));
+		$notify_one();
+		$state -= 2;
+		return true;
+	}
+
+	void shutdown() {
+		if ($state.fetch_or(1) & 1) {
+			if (!$is_in_worker()) {
+				$join();
+			}
+			return;
+		}
+
+		// Waits for the posts in flight.
+		while ($state.load() != 1) {
+			std::this_thread::yield();
+		}
+
+		$exiting.store(true);
+		$notify_all();
+
+		if ($is_in_worker()) {
+			return;
+		}
+		$join();
+	}
+
+private:
+	using $task_t = move_only_function<void()>;
+
+	struct $worker_t {
+		executor &owner;
+		size_t ix;
+		_work_stealing_deque<$task_t> deq;
+		dozer dzr;
+		std::weak_ptr<waker> wkr;
+
+		$worker_t(executor &owner, size_t ix) :
+			owner(owner), ix(ix), wkr(dzr.get_waker()) {}
+	};
+
+	std::atomic<size_t> $state;
+	std::atomic<bool> $exiting;
+	std::vector<std::unique_ptr<$worker_t>> $wkrs;
+	lockfree_queue<$task_t *, pool_allocator<$task_t *>> $injection;
+
+	std::atomic<size_t> $num_idle;
+	std::mutex $idle_mtx;
+	std::vector<$worker_t *> $idle_wkrs;
+
+	std::atomic<size_t> $alive;
+	std::mutex $join_mtx;
+	std::vector<std::weak_ptr<waker>> $join_wkrs;
+
+	static $task_t *$new_task($task_t &&task) {
+		pool_allocator<$task_t> pa;
+		auto t = pa.allocate(1);
+		construct(*t, std::move(task));
+		return t;
+	}
+
+	static void $delete_task($task_t *t) {
+		destruct(*t);
+		pool_allocator<$task_t> pa;
+		pa.deallocate(t, 1);
+	}
+
+	static thread_word_var &$this_worker_var() {
+		static auto inst = new thread_word_var([](any_word) {});
+		return *inst;
+	}
+
+	static $worker_t *$this_worker() {
+		auto &wv = $this_worker_var();
+		if (!wv.is_storable()) {
+			return nullptr;
+		}
+		return wv.get().as<$worker_t *>();
+	}
+
+	bool $is_in_worker() {
+		auto wkr = $this_worker();
+		return wkr && &wkr->owner == this;
+	}
+
+	$task_t *$find_task($worker_t &wkr) {
+		auto t = wkr.deq.take();
+		if (t) {
+			return t;
+		}
+		auto t_opt = $injection.pop_front();
+		if (t_opt) {
+			return *t_opt;
+		}
+		for (size_t i = 1; i < $wkrs.size(); ++i) {
+			t = $wkrs[(wkr.ix + i) % $wkrs.size()]->deq.steal();
+			if (t) {
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	void $run($worker_t &wkr) {
+		$this_worker_var().set(&wkr);
+
+		for (;;) {
+			auto t = $find_task(wkr);
+			if (t) {
+				(*t)();
+				$delete_task(t);
+				continue;
+			}
+
+			{
+				std::lock_guard<std::mutex> lg($idle_mtx);
+				$idle_wkrs.emplace_back(&wkr);
+				++$num_idle;
+			}
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			// Checks again, the posts before registration have not notified.
+			t = $find_task(wkr);
+			if (t || $exiting.load()) {
+				$cancel_idle(wkr);
+				if (!t) {
+					break;
+				}
+				(*t)();
+				$delete_task(t);
+				continue;
+			}
+			wkr.dzr.doze();
+			$cancel_idle(wkr);
+		}
+
+		$this_worker_var().set(nullptr);
+
+		std::vector<std::weak_ptr<waker>> join_wkrs;
+		{
+			std::lock_guard<std::mutex> lg($join_mtx);
+			if (--$alive) {
+				return;
+			}
+			join_wkrs = std::move($join_wkrs);
+		}
+		for (auto &join_wkr : join_wkrs) {
+			auto w = join_wkr.lock();
+			if (w) {
+				w->wake();
+			}
+		}
+	}
+
+	void $cancel_idle($worker_t &wkr) {
+		std::lock_guard<std::mutex> lg($idle_mtx);
+		for (auto it = $idle_wkrs.begin(); it != $idle_wkrs.end(); ++it) {
+			if (*it == &wkr) {
+				$idle_wkrs.erase(it);
+				--$num_idle;
+				return;
+			}
+		}
+		// Already woken, the next doze returns at once.
+	}
+
+	void $notify_one() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!$num_idle.load()) {
+			return;
+		}
+		$worker_t *wkr;
+		{
+			std::lock_guard<std::mutex> lg($idle_mtx);
+			if ($idle_wkrs.empty()) {
+				return;
+			}
+			wkr = $idle_wkrs.back();
+			$idle_wkrs.pop_back();
+			--$num_idle;
+		}
+		wkr->wkr.lock()->wake();
+	}
+
+	void $notify_all() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::vector<$worker_t *> wkrs;
+		{
+			std::lock_guard<std::mutex> lg($idle_mtx);
+			wkrs = std::move($idle_wkrs);
+			$idle_wkrs.clear();
+			$num_idle = 0;
+		}
+		for (auto wkr : wkrs) {
+			wkr->wkr.lock()->wake();
+		}
+	}
+
+	void $join() {
+		dozer dzr;
+		{
+			std::lock_guard<std::mutex> lg($join_mtx);
+			if (!$alive) {
+				return;
+			}
+			$join_wkrs.emplace_back(dzr.get_waker());
+		}
+		while ($alive.load()) {
+			dzr.doze();
+		}
+
+		// The last worker may still be holding it.
+		std::lock_guard<std::mutex> lg($join_mtx);
+	}
+};
+
+// Intentionally leaked, so that exiting the process does not wait for the
+// tasks. Call default_executor().shutdown() to drain them explicitly.
+inline executor &default_executor() {
+	static auto inst = new executor;
+	return *inst;
+}
+
+} // namespace rua
+
+#endif
@@ -2,10 +2,10 @@
 #define _rua_thread_parallel_hpp
 
 #include "core.hpp"
+#include "executor.hpp"
 
 #include "../invocable.hpp"
 #include "../move_only.hpp"
-#include "../conc/chan.hpp"
 #include "../conc/future.hpp"
 #include "../conc/promise.hpp"
 #include "../conc/then.hpp"
@@ -17,45 +17,63 @@
 
 namespace rua {
 
-inline void _parallel(std::function<void()> f) {
-	static chan<std::function<void()>> que;
-	if (que.send(std::move(f))) {
+inline void _parallel_blocking(move_only_function<void()> f) {
+	auto mf = make_move_only(std::move(f));
+	thread([mf]() mutable { mf.value()(); });
+}
+
+inline void _parallel(move_only_function<void()> f) {
+	if (default_executor().post(std::move(f))) {
 		return;
 	}
-	thread([]() {
-		for (;;) {
-			auto f = **que.recv();
-			f();
-		}
-	});
+	_parallel_blocking(std::move(f));
 }
 
 template <
+	void (*Post)(move_only_function<void()>),
 	typename Func,
 	typename... Args,
 	typename Result = invoke_result_t<Func, Args &&...>>
 inline enable_if_t<!std::is_void<Result>::value, future<Result>>
-parallel(Func func, Args &&...args) {
+_parallel_call(Func func, Args &&...args) {
 	auto prm = new newable_promise<Result>;
 	auto f = make_move_only(func);
-	_parallel([=]() mutable { prm->fulfill(f(args...)); });
+	Post([=]() mutable { prm->fulfill(f(args...)); });
 	return *prm;
 }
 
-template <typename Func, typename... Args>
+template <void (*Post)(move_only_function<void()>), typename Func, typename... Args>
 inline enable_if_t<
 	std::is_void<invoke_result_t<Func, Args &&...>>::value,
 	future<>>
-parallel(Func func, Args &&...args) {
+_parallel_call(Func func, Args &&...args) {
 	auto prm = new newable_promise<>;
 	auto f = make_move_only(func);
-	_parallel([=]() mutable {
+	Post([=]() mutable {
 		f(args...);
 		prm->fulfill();
 	});
 	return *prm;
 }
 
+// Runs on the default_executor().
+template <typename Func, typename... Args>
+inline auto parallel(Func func, Args &&...args)
+	-> decltype(_parallel_call<_parallel>(
+		std::move(func), std::forward<Args>(args)...)) {
+	return _parallel_call<_parallel>(
+		std::move(func), std::forward<Args>(args)...);
+}
+
+// Runs on a dedicated thread, for work that blocks.
+template <typename Func, typename... Args>
+inline auto parallel_blocking(Func func, Args &&...args)
+	-> decltype(_parallel_call<_parallel_blocking>(
+		std::move(func), std::forward<Args>(args)...)) {
+	return _parallel_call<_parallel_blocking>(
+		std::move(func), std::forward<Args>(args)...);
+}
+
 } // namespace rua
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef _rua_thread_parker_hpp
+#define _rua_thread_parker_hpp
+
+#include "../util/macros.hpp"
+
+#ifdef RUA_LINUX
+
+#include "parker/futex.hpp"
+
+namespace rua {
+
+using parker = futex::parker;
+
+} // namespace rua
+
+#else
+
+#include "parker/uni.hpp"
+
+namespace rua {
+
+using parker = uni::parker;
+
+} // namespace rua
+
+#endif
+
+#endif
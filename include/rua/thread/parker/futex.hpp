@@ -0,0 +1,135 @@
+#ifndef _rua_thread_parker_futex_hpp
+#define _rua_thread_parker_futex_hpp
+
+#include "../../hard.hpp"
+#include "../../time/duration.hpp"
+#include "../../time/tick.hpp"
+#include "../../util.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+namespace rua { namespace futex {
+
+/*
+	The state word is (epoch << 1) | permit.
+
+	Every park starts by taking a ticket with prepare(), an unpark() only
+	lands on the epoch of its ticket, and finish() moves on to the next epoch,
+	so a late unpark() of an earlier park can never wake a later one.
+
+	park() spins for a while before it sleeps on the state word, the spin
+	count follows how often spinning paid off recently.
+*/
+
+class parker {
+public:
+	using ticket_t = uint32_t;
+
+	constexpr parker() : $state(0), $spin_n($spin_init) {}
+
+	parker(const parker &) = delete;
+
+	parker &operator=(const parker &) = delete;
+
+	// Only called by the owner.
+	ticket_t prepare() {
+		auto state = $state.load(std::memory_order_relaxed);
+		assert(!(state & 1));
+		return state;
+	}
+
+	// Only called by the owner.
+	// Returns false on timeout.
+	bool park(ticket_t ticket, duration timeout = duration_max()) {
+		auto permit = ticket | 1;
+
+		if (num_cpus() > 1) {
+			for (size_t i = 0; i < $spin_n; ++i) {
+				if ($state.load(std::memory_order_acquire) == permit) {
+					if ($spin_n < $spin_max) {
+						$spin_n *= 2;
+					}
+					return true;
+				}
+				$cpu_relax();
+			}
+			if ($spin_n > $spin_min) {
+				$spin_n /= 2;
+			}
+		}
+
+		if (timeout == duration_max()) {
+			while ($state.load(std::memory_order_acquire) != permit) {
+				$wait(ticket, nullptr);
+			}
+			return true;
+		}
+
+		auto end_ti = tick() + timeout;
+		while ($state.load(std::memory_order_acquire) != permit) {
+			if (timeout <= 0) {
+				return false;
+			}
+			auto ts = timeout.c_timespec();
+			$wait(ticket, &ts);
+			timeout = end_ti - tick();
+		}
+		return true;
+	}
+
+	// Only called by the owner, after park() or when it gives up waiting.
+	void finish(ticket_t ticket) {
+		$state.store(ticket + 2, std::memory_order_relaxed);
+	}
+
+	void unpark(ticket_t ticket) {
+		if (!$state.compare_exchange_strong(
+				ticket, ticket | 1, std::memory_order_release)) {
+			return;
+		}
+		syscall(
+			SYS_futex,
+			reinterpret_cast<uint32_t *>(&$state),
+			FUTEX_WAKE_PRIVATE,
+			1,
+			nullptr,
+			nullptr,
+			0);
+	}
+
+private:
+	std::atomic<uint32_t> $state;
+	size_t $spin_n;
+
+	static constexpr size_t $spin_min = 16;
+	static constexpr size_t $spin_init = 128;
+	static constexpr size_t $spin_max = 4096;
+
+	static void $cpu_relax() {
+#if defined(RUA_X86) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_ia32_pause();
+#endif
+	}
+
+	void $wait(ticket_t ticket, const timespec *ts) {
+		syscall(
+			SYS_futex,
+			reinterpret_cast<uint32_t *>(&$state),
+			FUTEX_WAIT_PRIVATE,
+			ticket,
+			ts,
+			nullptr,
+			0);
+	}
+};
+
+}} // namespace rua::futex
+
+#endif
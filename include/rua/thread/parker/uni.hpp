@@ -0,0 +1,69 @@
+#ifndef _rua_thread_parker_uni_hpp
+#define _rua_thread_parker_uni_hpp
+
+#include "../../time/duration.hpp"
+#include "../../util.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace rua { namespace uni {
+
+// The same protocol as futex::parker, built on the standard library.
+class parker {
+public:
+	using ticket_t = uint32_t;
+
+	parker() : $state(0) {}
+
+	parker(const parker &) = delete;
+
+	parker &operator=(const parker &) = delete;
+
+	ticket_t prepare() {
+		std::lock_guard<std::mutex> lg($mtx);
+		assert(!($state & 1));
+		return $state;
+	}
+
+	bool park(ticket_t ticket, duration timeout = duration_max()) {
+		auto permit = ticket | 1;
+		std::unique_lock<std::mutex> ul($mtx);
+		if (timeout == duration_max()) {
+			$cv.wait(ul, [this, permit]() { return $state == permit; });
+			return true;
+		}
+		return $cv.wait_for(
+			ul,
+			std::chrono::nanoseconds(timeout.nanoseconds()),
+			[this, permit]() { return $state == permit; });
+	}
+
+	void finish(ticket_t ticket) {
+		std::lock_guard<std::mutex> lg($mtx);
+		$state = ticket + 2;
+	}
+
+	void unpark(ticket_t ticket) {
+		{
+			std::lock_guard<std::mutex> lg($mtx);
+			if ($state != ticket) {
+				return;
+			}
+			$state = ticket | 1;
+		}
+		$cv.notify_one();
+	}
+
+private:
+	std::mutex $mtx;
+	std::condition_variable $cv;
+	ticket_t $state;
+};
+
+}} // namespace rua::uni
+
+#endif
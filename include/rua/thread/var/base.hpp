@@ -3,17 +3,15 @@
 
 #include "../id.hpp"
 
-#include "../../dype/any.hpp"
 #include "../../dype/any_word.hpp"
 #include "../../lockfree_list.hpp"
+#include "../../optional.hpp"
 #include "../../util.hpp"
 
 #include <atomic>
 #include <cassert>
-#include <functional>
-#include <mutex>
+#include <deque>
 #include <type_traits>
-#include <unordered_map>
 #include <vector>
 
 namespace rua {
@@ -39,21 +37,27 @@ private:
 	lockfree_list<size_t> $idle_ixs;
 };
 
+// Used where there is no native thread word var, or when they run out.
+// Values live in a native thread_local slot array indexed by $ix, so neither
+// get() nor set() takes a lock.
+// The indexes are reused, a slot also keeps the generation of the var that
+// set it. A slot left by a previous owner reads as empty, and its value is
+// destructed by the dtor of that owner when the slot is set again.
 class spare_thread_word_var {
 public:
 	spare_thread_word_var(void (*dtor)(any_word)) :
-		$ix($ctx().ixer.alloc()), $dtor(dtor) {}
+		$ix($ixer().alloc()), $gen(++$gen_c()), $dtor(dtor) {}
 
 	~spare_thread_word_var() {
-		if (is_storable()) {
+		if (!is_storable()) {
 			return;
 		}
-		$ctx().ixer.dealloc($ix);
+		$ixer().dealloc($ix);
 		$ix = static_cast<size_t>(-1);
-		return;
 	}
 
-	spare_thread_word_var(spare_thread_word_var &&src) : $ix(src.$ix) {
+	spare_thread_word_var(spare_thread_word_var &&src) :
+		$ix(src.$ix), $gen(src.$gen), $dtor(src.$dtor) {
 		if (src.is_storable()) {
 			src.$ix = static_cast<size_t>(-1);
 		}
@@ -72,86 +76,80 @@ public:
 	}
 
 	void set(any_word value) {
-		auto &ctx = $ctx();
-		std::lock_guard<std::mutex> lg(ctx.mtx);
-
-		auto it = ctx.map.find(this_tid());
-		if (it == ctx.map.end()) {
-			ctx.map.emplace(
-				this_tid(),
-				std::make_pair(
-					static_cast<size_t>(0), std::vector<uintptr_t>()));
-			it = ctx.map.find(this_tid());
-		}
-		auto &li = it->second.second;
-		if (li.size() <= $ix) {
+		auto &slots = $slots();
+		if (slots.size() <= $ix) {
 			if (!value) {
 				return;
 			}
-			++it->second.first;
-			li.resize($ix + 1);
-		} else if (!li[$ix]) {
-			if (!value) {
-				return;
+			slots.resize($ix + 1);
+		}
+		auto &slot = slots[$ix];
+		if (slot.gen != $gen) {
+			auto old_val = exchange(slot.val, 0);
+			if (old_val && slot.dtor) {
+				slot.dtor(old_val);
 			}
-			++it->second.first;
-		} else if (li[$ix] && !value) {
-			--it->second.first;
+			slot.gen = $gen;
 		}
-		li[$ix] = value;
+		slot.val = value;
+		slot.dtor = $dtor;
 	}
 
 	any_word get() const {
-		auto &ctx = $ctx();
-		std::lock_guard<std::mutex> lg(ctx.mtx);
-
-		auto it = ctx.map.find(this_tid());
-		if (it == ctx.map.end()) {
-			return 0;
-		}
-		auto &li = it->second.second;
-		if (li.size() <= $ix) {
+		auto &slots = $slots();
+		if (slots.size() <= $ix || slots[$ix].gen != $gen) {
 			return 0;
 		}
-		return li[$ix];
+		return slots[$ix].val;
 	}
 
 	void reset() {
-		auto &ctx = $ctx();
-		std::lock_guard<std::mutex> lg(ctx.mtx);
-
-		auto it = ctx.map.find(this_tid());
-		if (it == ctx.map.end()) {
+		auto val = get();
+		if (!val) {
 			return;
 		}
-		auto &li = it->second.second;
-		if (li.size() <= $ix) {
-			return;
-		}
-		if (!li[$ix]) {
-			return;
-		}
-		$dtor(li[$ix]);
-		if (--it->second.first) {
-			ctx.map.erase(it);
-		}
+		$dtor(val);
+		set(0);
 	}
 
 private:
-	size_t $ix;
+	size_t $ix, $gen;
 	void (*$dtor)(any_word);
 
-	using $map_t =
-		std::unordered_map<tid_t, std::pair<size_t, std::vector<uintptr_t>>>;
+	struct $slot_t {
+		uintptr_t val;
+		size_t gen;
+		void (*dtor)(any_word);
+
+		$slot_t() : val(0), gen(0), dtor(nullptr) {}
+	};
 
-	struct $ctx_t {
-		_thread_var_indexer ixer;
-		std::mutex mtx;
-		$map_t map;
+	// Destructs the values left when the thread exits, which may still set
+	// other slots meanwhile.
+	struct $slots_t : std::vector<$slot_t> {
+		~$slots_t() {
+			for (size_t i = 0; i < size(); ++i) {
+				auto &slot = (*this)[i];
+				auto val = exchange(slot.val, 0);
+				if (val && slot.dtor) {
+					slot.dtor(val);
+				}
+			}
+		}
 	};
 
-	static $ctx_t &$ctx() {
-		static $ctx_t inst;
+	static $slots_t &$slots() {
+		static thread_local $slots_t inst;
+		return inst;
+	}
+
+	static _thread_var_indexer &$ixer() {
+		static _thread_var_indexer inst;
+		return inst;
+	}
+
+	static std::atomic<size_t> &$gen_c() {
+		static std::atomic<size_t> inst(0);
 		return inst;
 	}
 };
@@ -181,16 +179,8 @@ public:
 	}
 
 	bool has_value() const {
-		auto &wv = using_word_var();
-		auto w = wv.get();
-		if (!w) {
-			return false;
-		}
-		auto &li = w.template as<std::vector<any>>();
-		if (li.size() <= $ix) {
-			return false;
-		}
-		return li[$ix].template type_is<T>();
+		auto li = $find_li();
+		return li && li->size() > $ix && (*li)[$ix].has_value();
 	}
 
 	template <typename... Args>
@@ -201,24 +191,20 @@ public:
 		if (li.size() <= $ix) {
 			li.resize($ix + 1);
 		}
-		return li[$ix].template emplace<T>(std::forward<Args>(args)...);
+		li[$ix].emplace(std::forward<Args>(args)...);
+		return li[$ix].value();
 	}
 
 	T &value() const {
-		return $li()[$ix].template as<T>();
+		return $li()[$ix].value();
 	}
 
 	void reset() {
-		auto &wv = using_word_var();
-		auto w = wv.get();
-		if (!w) {
+		auto li = $find_li();
+		if (!li || li->size() <= $ix) {
 			return;
 		}
-		auto &li = w.template as<std::vector<any>>();
-		if (li.size() <= $ix) {
-			return;
-		}
-		li[$ix].reset();
+		(*li)[$ix].reset();
 	}
 
 	class word_var_wrapper {
@@ -290,30 +276,57 @@ public:
 private:
 	size_t $ix;
 
+	// Typed in place, a deque keeps the references to the values of the
+	// other vars when it grows.
+	using $li_t = std::deque<optional<T>>;
+
 	template <typename TWV>
 	static TWV &$word_var() {
 		static TWV inst([](any_word val) {
+			// May run on another thread (e.g. on Windows), which only costs
+			// that thread a lookup.
+			$cache() = nullptr;
 			if (!val) {
 				return;
 			}
-			val.destruct<std::vector<any>>();
+			val.destruct<$li_t>();
 		});
 		return inst;
 	}
 
+	// The word var owns the list, this only saves the lookup through it.
+	static $li_t *&$cache() {
+		static thread_local $li_t *inst = nullptr;
+		return inst;
+	}
+
 	static _thread_var_indexer &$ixer() {
 		static _thread_var_indexer inst;
 		return inst;
 	}
 
-	static std::vector<any> &$li() {
-		auto &wv = using_word_var();
-		auto w = wv.get();
+	static $li_t *$find_li() {
+		auto &cache = $cache();
+		if (cache) {
+			return cache;
+		}
+		auto w = using_word_var().get();
 		if (!w) {
-			w = any_word(std::vector<any>());
-			wv.set(w);
+			return nullptr;
+		}
+		cache = &w.template as<$li_t>();
+		return cache;
+	}
+
+	static $li_t &$li() {
+		auto li = $find_li();
+		if (li) {
+			return *li;
 		}
-		return w.template as<std::vector<any>>();
+		auto w = any_word($li_t());
+		using_word_var().set(w);
+		$cache() = &w.template as<$li_t>();
+		return *$cache();
 	}
 };
 
@@ -13,9 +13,14 @@ inline future<any_word> thread::RUA_OPERATOR_AWAIT() const {
 		return 0;
 	}
 	auto id = $id;
-	return parallel([id]() -> any_word {
+	auto res = $res;
+	return parallel_blocking([id, res]() -> any_word {
 		void *retval;
 		pthread_join(id, &retval);
+		// A joined thread is gone, it must not be detached any more.
+		if (res) {
+			res->is_joined = true;
+		}
 		return retval;
 	});
 }
@@ -355,11 +355,11 @@ public:
 	}
 
 	constexpr bool operator>=(duration target) const {
-		return $s >= target.$s || ($s == target.$s && $ns >= target.$ns);
+		return $s > target.$s || ($s == target.$s && $ns >= target.$ns);
 	}
 
 	constexpr bool operator<=(duration target) const {
-		return $s <= target.$s || ($s == target.$s && $ns <= target.$ns);
+		return $s < target.$s || ($s == target.$s && $ns <= target.$ns);
 	}
 
 	constexpr duration operator+(duration target) const {
@@ -131,6 +131,25 @@ RUA_CODE_FN(
 	(ucontext_t * oucp, const ucontext_t *ucp),
 	_swap_ucontext_code)
 
+#ifdef _WIN32
+
+// The lowest committed address of the stack, the limit that the system
+// keeps for the stacks it grows by the guard pages.
+inline uchar *_stack_commit_limit(bytes_ref stack) {
+	auto it = stack.data();
+	auto end = stack.data() + stack.size();
+	MEMORY_BASIC_INFORMATION info;
+	while (it < end && VirtualQuery(it, &info, sizeof(info))) {
+		if (info.State == MEM_COMMIT && !(info.Protect & PAGE_GUARD)) {
+			return it;
+		}
+		it = reinterpret_cast<uchar *>(info.BaseAddress) + info.RegionSize;
+	}
+	return stack.data();
+}
+
+#endif
+
 inline void make_ucontext(
 	ucontext_t *ucp,
 	void (*func)(any_word),
@@ -138,10 +157,17 @@ inline void make_ucontext(
 	bytes_ref stack) {
 
 	ucp->stack.base = stack.data() + stack.size();
-	ucp->stack.base -= ucp->stack.base % sizeof(uintptr_t);
+	ucp->stack.base -= ucp->stack.base % 16;
+#ifdef _WIN32
+	ucp->stack.limit = _stack_commit_limit(stack);
+#else
 	ucp->stack.limit = stack.data();
+#endif
 
-	ucp->regs.sp = ucp->stack.base.uintptr() - 5 * sizeof(uintptr_t);
+	// swap_ucontext() enters by ret, so func starts with the stack pointer
+	// one word above this, like right after a call from a 16-byte aligned
+	// frame.
+	ucp->regs.sp = ucp->stack.base.uintptr() - 6 * sizeof(uintptr_t);
 	ucp->regs.ip = reinterpret_cast<uintptr_t>(func);
 
 #if RUA_X86 == 64
@@ -156,6 +182,68 @@ inline void make_ucontext(
 		= func_param;
 }
 
+#if RUA_X86 == 64 && !defined(RUA_MS64_FASTCALL)
+
+#define RUA_JUMP_UCONTEXT
+
+/*
+	For switches made by a cooperative scheduler, which only have to keep
+	what a function call keeps: the callee-saved registers, mxcsr and fcw are
+	pushed onto the stack of the context, only its stack pointer is left.
+*/
+
+struct jump_ucontext_t {
+	any_ptr $sp;
+
+	any_ptr &sp() {
+		return $sp;
+	}
+
+	const any_ptr &sp() const {
+		return $sp;
+	}
+};
+
+RUA_CODE(_jump_ucontext_code) {
+#include "ucontext/jump_amd64_sysv.inc"
+};
+
+RUA_CODE_FN(
+	uintptr_t,
+	_jump_ucontext,
+	(any_ptr * from_sp, uintptr_t to_sp, uintptr_t data),
+	_jump_ucontext_code)
+
+// Passes data to the context switched to, returns the data passed by the one
+// that switches back.
+inline any_word jump_ucontext(
+	jump_ucontext_t *ojucp, const jump_ucontext_t *jucp, any_word data = 0) {
+	return _jump_ucontext(&ojucp->$sp, jucp->$sp.uintptr(), data.value());
+}
+
+// The first jump_ucontext() to it calls func with the data it passes, func
+// must not return.
+inline void make_jump_ucontext(
+	jump_ucontext_t *jucp, void (*func)(any_word), bytes_ref stack) {
+
+	auto stack_base = any_ptr(stack.data() + stack.size());
+	stack_base -= stack_base % 16;
+
+	// Popped by jump_ucontext() like a saved context, then ret to func with
+	// a null return address above, the same alignment as a call.
+	auto frame = (stack_base - 9 * sizeof(uintptr_t)).as<uintptr_t *>();
+	frame[0] = 0x1F80 | (static_cast<uintptr_t>(0x037F) << 32); // mxcsr, fcw
+	for (int i = 1; i < 7; ++i) {
+		frame[i] = 0;
+	}
+	frame[7] = reinterpret_cast<uintptr_t>(func);
+	frame[8] = 0;
+
+	jucp->$sp = frame;
+}
+
+#endif
+
 } // namespace rua
 
 #elif defined(RUA_ARM) && RUA_ARM == 32
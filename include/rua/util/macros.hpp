@@ -149,6 +149,10 @@
 
 #endif
 
+#ifdef __linux__
+#define RUA_LINUX
+#endif
+
 #endif
 
 #if defined(_AMD64_) || (defined(_M_AMD64_) && _M_AMD64_ == 100) ||            \
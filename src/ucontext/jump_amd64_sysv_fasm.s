@@ -0,0 +1,36 @@
+use64
+
+; rdi: from_sp, rsi: to_sp, rdx: data
+
+push rbp
+push rbx
+push r12
+push r13
+push r14
+push r15
+
+sub rsp, 8
+stmxcsr [rsp]
+fnstcw [rsp+4]
+
+mov [rdi], rsp
+
+;;;;;
+
+mov rsp, rsi
+
+ldmxcsr [rsp]
+fldcw [rsp+4]
+add rsp, 8
+
+pop r15
+pop r14
+pop r13
+pop r12
+pop rbx
+pop rbp
+
+; returns data, or passes it as the first argument of a new context
+mov rax, rdx
+mov rdi, rdx
+ret
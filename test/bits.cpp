@@ -0,0 +1,119 @@
+#include <rua/binary/bits.hpp>
+#include <rua/log.hpp>
+#include <rua/time.hpp>
+
+#include <doctest/doctest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+TEST_CASE("compare bits") {
+	std::vector<rua::uchar> a(300), b(300), mask(300), masked(300);
+	for (size_t i = 0; i < a.size(); ++i) {
+		a[i] = static_cast<rua::uchar>(i * 13 + 7);
+		mask[i] = static_cast<rua::uchar>(i % 3 ? 0xFF : 0xF0);
+		masked[i] = a[i] & mask[i];
+	}
+
+	// Covers the unaligned heads and every tail length of the vectors.
+	for (size_t off = 0; off < 4; ++off) {
+		for (size_t sz = 0; sz + off <= 100; ++sz) {
+			b = a;
+			REQUIRE(rua::bit_equal(&a[off], &b[off], sz));
+			REQUIRE(rua::bit_and_equal(&a[off], &b[off], &mask[off], sz));
+			REQUIRE(rua::bit_contains(&masked[off], &b[off], &mask[off], sz));
+
+			for (size_t i = off; i < off + sz; ++i) {
+				b[i] ^= 0x10;
+				REQUIRE(!rua::bit_equal(&a[off], &b[off], sz));
+				REQUIRE(!rua::bit_and_equal(&a[off], &b[off], &mask[off], sz));
+				REQUIRE(
+					!rua::bit_contains(&masked[off], &b[off], &mask[off], sz));
+				b[i] = a[i];
+
+				if (i % 3) {
+					continue;
+				}
+
+				// Out of the mask.
+				b[i] ^= 0x01;
+				REQUIRE(!rua::bit_equal(&a[off], &b[off], sz));
+				REQUIRE(rua::bit_and_equal(&a[off], &b[off], &mask[off], sz));
+				REQUIRE(
+					rua::bit_contains(&masked[off], &b[off], &mask[off], sz));
+				b[i] = a[i];
+			}
+
+			// Just out of the range.
+			if (off) {
+				b[off - 1] ^= 0xFF;
+			}
+			b[off + sz] ^= 0xFF;
+			REQUIRE(rua::bit_equal(&a[off], &b[off], sz));
+		}
+	}
+}
+
+TEST_CASE("benchmark bit comparisons") {
+	static constexpr size_t total =
+#ifdef NDEBUG
+		256 * 1024 * 1024;
+#else
+		16 * 1024 * 1024;
+#endif
+
+	std::string a(1024 * 1024, 'a'), mask(a.size(), '\xFF');
+	auto b = a;
+	auto pa = reinterpret_cast<const rua::uchar *>(a.data());
+	auto pb = reinterpret_cast<const rua::uchar *>(b.data());
+	auto pm = reinterpret_cast<const rua::uchar *>(mask.data());
+
+	for (size_t sz : {8, 24, 64, 256, 4096, 1024 * 1024}) {
+		auto n = total / sz;
+
+		size_t n_eq = 0;
+		auto t = rua::tick();
+		for (size_t i = 0; i < n; ++i) {
+			n_eq += rua::bit_equal(pa, pb + (i & 1), sz - (i & 1));
+		}
+		auto bit_equal_dur = rua::tick() - t;
+
+		size_t n_and_eq = 0;
+		t = rua::tick();
+		for (size_t i = 0; i < n; ++i) {
+			n_and_eq += rua::bit_and_equal(pa, pb + (i & 1), pm, sz - (i & 1));
+		}
+		auto bit_and_equal_dur = rua::tick() - t;
+
+		size_t n_contains = 0;
+		t = rua::tick();
+		for (size_t i = 0; i < n; ++i) {
+			n_contains += rua::bit_contains(pa, pb + (i & 1), pm, sz - (i & 1));
+		}
+		auto bit_contains_dur = rua::tick() - t;
+
+		size_t n_memcmp = 0;
+		t = rua::tick();
+		for (size_t i = 0; i < n; ++i) {
+			n_memcmp += !memcmp(pa, pb + (i & 1), sz - (i & 1));
+		}
+		auto memcmp_dur = rua::tick() - t;
+
+		REQUIRE(n_eq == n);
+		REQUIRE(n_and_eq == n);
+		REQUIRE(n_contains == n);
+		REQUIRE(n_memcmp == n);
+
+		rua::log(
+			sz,
+			"bytes, bit_equal:",
+			bit_equal_dur,
+			"bit_and_equal:",
+			bit_and_equal_dur,
+			"bit_contains:",
+			bit_contains_dur,
+			"memcmp:",
+			memcmp_dur);
+	}
+}
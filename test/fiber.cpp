@@ -0,0 +1,120 @@
+#include <rua/fiber.hpp>
+#include <rua/thread.hpp>
+#include <rua/time.hpp>
+
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <string>
+
+TEST_CASE("run fibers") {
+	auto r = *rua::fiber([]() -> std::string {
+		*rua::sleep_for(10);
+		return "ok";
+	});
+	REQUIRE(r);
+	REQUIRE(*r == "ok");
+}
+
+TEST_CASE("wait on fibers without blocking workers") {
+	static const size_t num = 5000;
+	static std::atomic<size_t> sum(0);
+
+	rua::chan<size_t> ch;
+	rua::mutex mtx;
+	size_t counter = 0;
+
+	{
+		rua::fiber_scheduler sch(2);
+		REQUIRE(sch.size() == 2);
+
+		for (size_t i = 0; i < num; ++i) {
+			REQUIRE(sch.spawn([&ch, &mtx, &counter, i]() {
+				if (i % 2) {
+					ch.send(i);
+				} else {
+					sum += **ch.recv();
+				}
+				auto ul = *mtx.lock();
+				++counter;
+			}));
+		}
+
+		rua::fiber_scheduler sleeper(1);
+		for (size_t i = 0; i < 100; ++i) {
+			sleeper.spawn([]() {
+				*rua::sleep_for(50);
+				++sum;
+			});
+		}
+	}
+
+	REQUIRE(counter == num);
+	REQUIRE(sum == (num / 2) * (num / 2) + 100);
+}
+
+TEST_CASE("spawn from fibers while the scheduler is exiting") {
+	for (size_t n = 0; n < 500; ++n) {
+		std::atomic<size_t> num_accepted(0), num_run(0);
+
+		{
+			rua::fiber_scheduler sch(4);
+			for (size_t i = 0; i < 16; ++i) {
+				sch.spawn([&sch, &num_accepted, &num_run]() {
+					if (sch.spawn([&num_run]() { ++num_run; })) {
+						++num_accepted;
+					}
+				});
+			}
+		}
+
+		REQUIRE(num_run == num_accepted);
+	}
+}
+
+TEST_CASE("try_wait on fiber") {
+	rua::chan<int> ch;
+	auto t = rua::tick();
+	auto r = *rua::fiber([&ch]() -> bool {
+		return !rua::try_wait(ch.recv(), 100);
+	});
+	REQUIRE(r);
+	CHECK(*r);
+	CHECK((rua::tick() - t).milliseconds() >= 100);
+}
+
+TEST_CASE("wait on fibers on a shared stack") {
+	static const size_t num = 20000;
+	static std::atomic<size_t> sum(0), num_broken(0);
+
+	rua::chan<size_t> ch;
+
+	{
+		rua::fiber_scheduler sch(1, 1024 * 1024, true);
+
+		for (size_t i = 0; i < num; ++i) {
+			sch.spawn([&ch, i]() {
+				if (i % 2) {
+					ch.send(i);
+					return;
+				}
+
+				// The locals have to survive being copied out and back.
+				size_t locals[64];
+				for (size_t j = 0; j < 64; ++j) {
+					locals[j] = i + j;
+				}
+				sum += **ch.recv();
+				for (size_t j = 0; j < 64; ++j) {
+					if (locals[j] != i + j) {
+						++num_broken;
+						break;
+					}
+				}
+			});
+		}
+	}
+
+	REQUIRE(num_broken == 0);
+	REQUIRE(sum == (num / 2) * (num / 2));
+}
@@ -1,10 +1,38 @@
 #include <rua/binary/bytes.hpp>
+#include <rua/binary/parallel_find.hpp>
+#include <rua/binary/pattern_set.hpp>
 #include <rua/log.hpp>
 #include <rua/string.hpp>
 #include <rua/time.hpp>
 
 #include <doctest/doctest.h>
 
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Repeats often enough to have the matches a pattern cut from it has.
+static std::string find_test_data(size_t size) {
+	std::string str(size, 'a');
+	for (size_t i = 0; i < str.size(); ++i) {
+		str[i] = static_cast<char>('a' + (i * 7 + i / 13) % 5);
+	}
+	return str;
+}
+
+// The bytes with wildcards at the given indexes.
+static rua::bytes_pattern
+masked_pattern(rua::bytes_view byts, const std::vector<size_t> &wildcards) {
+	rua::bytes masked(byts);
+	rua::bytes mask(byts.size());
+	memset(mask.data(), 0xFF, mask.size());
+	for (auto i : wildcards) {
+		masked[i] = 0;
+		mask[i] = 0;
+	}
+	return rua::bytes_pattern(std::move(masked), std::move(mask));
+}
+
 TEST_CASE("memory find") {
 	size_t dat_sz = 1024 * 1024 *
 #ifdef NDEBUG
@@ -170,6 +198,31 @@ TEST_CASE("memory find") {
 	REQUIRE(rfr[0].data() - dat.data() == pat_pos + 1);
 	REQUIRE(rfr[0].size() == 1);
 
+	// parallel_index_of
+
+	tp = rua::tick();
+
+	auto pos_exp =
+		*rua::parallel_index_of(dat, {255, 255, 255, 255, 255, 6, 7, 255});
+
+	rua::log("parallel_index_of:", rua::tick() - tp);
+
+	REQUIRE(pos_exp);
+	REQUIRE(*pos_exp);
+	REQUIRE(**pos_exp == pat_pos);
+
+	// parallel_last_index_of
+
+	tp = rua::tick();
+
+	pos_exp = *rua::parallel_last_index_of(dat, "FF ?? FF FF FF 06 07 FF");
+
+	rua::log("parallel_last_index_of:", rua::tick() - tp);
+
+	REQUIRE(pos_exp);
+	REQUIRE(*pos_exp);
+	REQUIRE(**pos_exp == pat_pos);
+
 	// std::string::find
 
 	tp = rua::tick();
@@ -192,3 +245,328 @@ TEST_CASE("memory find") {
 	REQUIRE(pos != static_cast<size_t>(-1));
 	REQUIRE(pos == pat_pos);
 }
+
+TEST_CASE("memory find with start positions and masks") {
+	auto dat_str = find_test_data(1000);
+	auto dat = rua::as_bytes(dat_str);
+
+	auto naive_index_of = [&](const rua::bytes_pattern &pat,
+							  size_t start_pos) -> size_t {
+		for (auto i = start_pos; i + pat.size() <= dat.size(); ++i) {
+			if (pat.contains(dat(i, i + pat.size()))) {
+				return i;
+			}
+		}
+		return rua::nullpos;
+	};
+
+	auto naive_last_index_of = [&](const rua::bytes_pattern &pat,
+								   size_t end_pos) -> size_t {
+		for (auto i = end_pos; i-- > 0;) {
+			if (i + pat.size() <= end_pos &&
+				pat.contains(dat(i, i + pat.size()))) {
+				return i;
+			}
+		}
+		return rua::nullpos;
+	};
+
+	// Covers every tail length of the vector loops.
+	for (size_t pat_sz = 1; pat_sz < 12; ++pat_sz) {
+		for (size_t pat_pos = 0; pat_pos + pat_sz <= 120; pat_pos += 7) {
+			// With a wildcard in the middle.
+			rua::bytes_pattern pats[]{
+				dat(pat_pos, pat_pos + pat_sz),
+				masked_pattern(dat(pat_pos, pat_pos + pat_sz), {pat_sz / 2})};
+
+			for (auto &pat : pats) {
+				for (size_t start_pos = 0; start_pos <= 130; start_pos += 13) {
+					auto pos_opt = dat.index_of(pat, start_pos);
+					auto pos = naive_index_of(pat, start_pos);
+					REQUIRE((pos_opt ? *pos_opt : rua::nullpos) == pos);
+
+					auto end_pos = dat.size() - start_pos;
+					pos_opt = dat.last_index_of(pat, end_pos);
+					pos = naive_last_index_of(pat, end_pos);
+					REQUIRE((pos_opt ? *pos_opt : rua::nullpos) == pos);
+				}
+			}
+		}
+	}
+
+	// The last candidate.
+	dat_str.back() = 'z';
+	REQUIRE(*dat.index_of({'z'}) == dat.size() - 1);
+	REQUIRE(*dat.last_index_of({'z'}) == dat.size() - 1);
+	REQUIRE(*dat.index_of({'z'}, dat.size() - 1) == dat.size() - 1);
+	REQUIRE(!dat.index_of({'z'}, dat.size()));
+	REQUIRE(!dat.last_index_of({'z'}, dat.size() - 1));
+
+	// Finders step over the previous match.
+	std::string rep_str("xyz..xyz..xyz");
+	auto rep = rua::as_bytes(rep_str);
+	size_t n = 0;
+	for (auto fr = rep.find({'x', 'y', 'z'}); fr; ++fr) {
+		REQUIRE(fr.pos() == n * 5);
+		++n;
+	}
+	REQUIRE(n == 3);
+	n = 0;
+	for (auto fr = rep.rfind({'x', 'y', 'z'}); fr; ++fr) {
+		REQUIRE(fr.pos() == (2 - n) * 5);
+		++n;
+	}
+	REQUIRE(n == 3);
+}
+
+TEST_CASE("memory find with compiled patterns") {
+	auto dat_str = find_test_data(4000);
+	auto dat = rua::as_bytes(dat_str);
+
+	// Long enough to have the skip tables without the vector scan.
+	for (size_t pat_sz = 32; pat_sz < 80; pat_sz += 9) {
+		for (size_t pat_pos = 0; pat_pos + pat_sz <= 3000; pat_pos += 997) {
+			rua::bytes_pattern pats[]{
+				dat(pat_pos, pat_pos + pat_sz),
+				masked_pattern(
+					dat(pat_pos, pat_pos + pat_sz), {3, pat_sz - 2})};
+
+			for (auto &pat : pats) {
+				rua::compiled_bytes_pattern cpat(pat);
+				REQUIRE(cpat.size() == pat_sz);
+
+				for (size_t start_pos = 0; start_pos <= 3500;
+					 start_pos += 501) {
+					auto pos_opt = dat.index_of(cpat, start_pos);
+					auto pos_opt2 = dat.index_of(pat, start_pos);
+					REQUIRE(pos_opt.has_value() == pos_opt2.has_value());
+					if (pos_opt) {
+						REQUIRE(*pos_opt == *pos_opt2);
+					}
+
+					auto end_pos = dat.size() - start_pos;
+					pos_opt = dat.last_index_of(cpat, end_pos);
+					pos_opt2 = dat.last_index_of(pat, end_pos);
+					REQUIRE(pos_opt.has_value() == pos_opt2.has_value());
+					if (pos_opt) {
+						REQUIRE(*pos_opt == *pos_opt2);
+					}
+				}
+
+				// Finders keep the compiled pattern across the iterations.
+				size_t n = 0, last_pos = 0;
+				for (auto fr = rua::const_bytes_finder::find(dat, cpat, {}); fr;
+					 ++fr) {
+					REQUIRE((!n || fr.pos() >= last_pos + pat_sz));
+					last_pos = fr.pos();
+					++n;
+				}
+				REQUIRE(n > 0);
+
+				// The skip tables directly, compiled patterns leave them for
+				// the vector scan where it is available.
+				auto run =
+					rua::_longest_bytes_run(pat.mask().data(), pat.size());
+				REQUIRE(run.size);
+				auto run_data = pat.masked().data() + run.off;
+				rua::_bytes_skip_table tab(run_data, run.size);
+				auto verify = [&pat](const rua::uchar *it) {
+					return pat.contains(rua::bytes_view(it, pat.size()));
+				};
+
+				for (size_t start_pos = 0; start_pos <= 3500;
+					 start_pos += 501) {
+					auto n_pos = dat.size() - start_pos - pat_sz + 1;
+					auto pos = rua::_bytes_horspool_scan(
+						dat.data() + start_pos,
+						n_pos,
+						run_data,
+						run,
+						tab,
+						verify);
+					auto pos_opt = dat.index_of(pat, start_pos);
+					REQUIRE(
+						pos ==
+						(pos_opt ? *pos_opt - start_pos : rua::nullpos));
+
+					auto end_pos = dat.size() - start_pos;
+					pos = rua::_bytes_horspool_rscan(
+						dat.data(),
+						end_pos - pat_sz + 1,
+						run_data,
+						run,
+						tab,
+						verify);
+					pos_opt = dat.last_index_of(pat, end_pos);
+					REQUIRE(pos == (pos_opt ? *pos_opt : rua::nullpos));
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("memory find with pattern sets") {
+	auto dat_str = find_test_data(5000);
+	auto dat = rua::as_bytes(dat_str);
+
+	std::vector<rua::bytes_pattern> pats;
+	for (size_t pat_sz = 1; pat_sz < 24; pat_sz += 2) {
+		for (size_t pat_pos = pat_sz * 31; pat_pos < 4900; pat_pos += 1231) {
+			pats.emplace_back(dat(pat_pos, pat_pos + pat_sz));
+
+			std::vector<size_t> wildcards;
+			for (size_t i = pat_pos % 3; i < pat_sz; i += 3) {
+				wildcards.emplace_back(i);
+			}
+			pats.emplace_back(
+				masked_pattern(dat(pat_pos, pat_pos + pat_sz), wildcards));
+		}
+	}
+	pats.emplace_back("?? ?? 61");
+	pats.emplace_back("?? ??");
+	pats.emplace_back("7A 7A");
+	pats.emplace_back(pats.front());
+
+	std::vector<rua::bytes_pattern_hit> naive_hits;
+	for (size_t i = 0; i < dat.size(); ++i) {
+		for (size_t id = 0; id < pats.size(); ++id) {
+			auto &pat = pats[id];
+			if (i + pat.size() <= dat.size() &&
+				pat.contains(dat(i, i + pat.size()))) {
+				naive_hits.push_back({id, i});
+			}
+		}
+	}
+	REQUIRE(naive_hits.size() > pats.size());
+
+	auto is_same_hits = [](const std::vector<rua::bytes_pattern_hit> &a,
+						   const std::vector<rua::bytes_pattern_hit> &b) {
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); ++i) {
+			if (a[i].id != b[i].id || a[i].offset != b[i].offset) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	rua::bytes_pattern_set pat_set(pats);
+	REQUIRE(pat_set.size() == pats.size());
+	REQUIRE(is_same_hits(pat_set.find_all(dat), naive_hits));
+
+	// The hits that cross the chunks.
+	for (size_t chunk_sz : {1, 2, 7, 64, 1000}) {
+		rua::bytes_pattern_scanner scanner(pat_set);
+		std::vector<rua::bytes_pattern_hit> hits;
+		for (size_t pos = 0; pos < dat.size(); pos += chunk_sz) {
+			scanner.scan(
+				dat(pos, std::min(pos + chunk_sz, dat.size())),
+				[&hits](const rua::bytes_pattern_hit &hit) {
+					hits.emplace_back(hit);
+				});
+		}
+		REQUIRE(scanner.pos() == dat.size());
+		std::sort(
+			hits.begin(),
+			hits.end(),
+			[](const rua::bytes_pattern_hit &a,
+			   const rua::bytes_pattern_hit &b) {
+				return a.offset < b.offset ||
+					   (a.offset == b.offset && a.id < b.id);
+			});
+		REQUIRE(is_same_hits(hits, naive_hits));
+	}
+
+	REQUIRE(rua::bytes_pattern_set().find_all(dat).empty());
+
+	// Compared with a pass per pattern.
+
+	std::string big_str(
+		1024 * 1024 *
+#ifdef NDEBUG
+			16
+#else
+			1
+#endif
+		,
+		0);
+	std::mt19937 rng(1);
+	for (auto &c : big_str) {
+		c = static_cast<char>(rng());
+	}
+	auto big = rua::as_bytes(big_str);
+
+	pats.resize(pats.size() - 4);
+	pat_set = rua::bytes_pattern_set(pats);
+
+	auto tp = rua::tick();
+
+	size_t n = 0;
+	for (auto &pat : pats) {
+		for (auto fr = big.find(pat); fr; ++fr) {
+			++n;
+		}
+	}
+
+	rua::log("bytes::find *", pats.size(), ":", rua::tick() - tp);
+
+	tp = rua::tick();
+
+	size_t n2 = 0;
+	pat_set.scan(big, [&n2](const rua::bytes_pattern_hit &) { ++n2; });
+
+	rua::log("bytes_pattern_set::scan:", rua::tick() - tp);
+
+	REQUIRE(n == n2);
+}
+
+TEST_CASE("memory find in parallel") {
+	auto dat_str = find_test_data(3000);
+	auto dat = rua::as_bytes(dat_str);
+
+	for (size_t pat_sz = 1; pat_sz < 40; pat_sz += 6) {
+		rua::bytes_pattern pats[]{
+			dat(1500, 1500 + pat_sz),
+			masked_pattern(dat(1500, 1500 + pat_sz), {pat_sz / 2})};
+
+		for (auto &pat : pats) {
+			std::vector<size_t> poss;
+			for (auto pos_opt = dat.index_of(pat); pos_opt;
+				 pos_opt = dat.index_of(pat, *pos_opt + 1)) {
+				poss.emplace_back(*pos_opt);
+			}
+			REQUIRE(poss.size());
+
+			// Every match crosses the chunks of 1.
+			for (size_t chunk_sz : {1, 5, 64, 1000, 0}) {
+				auto pos_exp = *rua::parallel_index_of(dat, pat, chunk_sz);
+				REQUIRE(pos_exp);
+				REQUIRE(*pos_exp);
+				REQUIRE(**pos_exp == poss.front());
+
+				pos_exp = *rua::parallel_last_index_of(dat, pat, chunk_sz);
+				REQUIRE(pos_exp);
+				REQUIRE(*pos_exp);
+				REQUIRE(**pos_exp == poss.back());
+
+				auto poss_exp = *rua::parallel_indexes_of(dat, pat, chunk_sz);
+				REQUIRE(poss_exp);
+				REQUIRE(*poss_exp == poss);
+			}
+		}
+	}
+
+	auto pos_exp = *rua::parallel_index_of(dat, {'z', 'z'}, 100);
+	REQUIRE(pos_exp);
+	REQUIRE(!*pos_exp);
+
+	pos_exp = *rua::parallel_last_index_of(dat, {'z', 'z'}, 100);
+	REQUIRE(pos_exp);
+	REQUIRE(!*pos_exp);
+
+	auto poss_exp = *rua::parallel_indexes_of(dat(0, 1), {'a', 'b'}, 100);
+	REQUIRE(poss_exp);
+	REQUIRE(poss_exp->empty());
+}
@@ -0,0 +1,161 @@
+#include <rua/conc.hpp>
+#include <rua/lockfree_list.hpp>
+#include <rua/log.hpp>
+#include <rua/pool_allocator.hpp>
+
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t> test_new_count(0);
+
+RUA_NO_INLINE void *operator new(size_t size) {
+	++test_new_count;
+	auto ptr = std::malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+RUA_NO_INLINE void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+RUA_NO_INLINE void operator delete(void *ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+TEST_CASE("pool_allocator") {
+	static constexpr size_t n = 10000;
+
+	// warm up the per-thread caches
+	rua::lockfree_list<int, rua::pool_allocator<int>> pool_li;
+	for (int i = 0; i < 100; ++i) {
+		pool_li.emplace_front(i);
+	}
+	while (pool_li.pop_front())
+		;
+
+	rua::lockfree_list<int> std_li;
+	auto new_c = test_new_count.load();
+	for (size_t i = 0; i < n; ++i) {
+		std_li.emplace_front(static_cast<int>(i));
+		REQUIRE(*std_li.pop_front() == static_cast<int>(i));
+	}
+	auto std_new_c = test_new_count.load() - new_c;
+	rua::log("lockfree_list<std::allocator> allocs:", std_new_c, "/", n);
+	REQUIRE(std_new_c >= n);
+
+	new_c = test_new_count.load();
+	for (size_t i = 0; i < n; ++i) {
+		pool_li.emplace_front(static_cast<int>(i));
+		REQUIRE(*pool_li.pop_front() == static_cast<int>(i));
+	}
+	auto pool_new_c = test_new_count.load() - new_c;
+	rua::log("lockfree_list<pool_allocator> allocs:", pool_new_c, "/", n);
+	REQUIRE(pool_new_c == 0);
+
+	rua::chan<int> ch;
+	for (int i = 0; i < 100; ++i) {
+		ch.send(i);
+	}
+	while (ch.try_recv())
+		;
+
+	new_c = test_new_count.load();
+	for (size_t i = 0; i < n; ++i) {
+		ch.send(static_cast<int>(i));
+		REQUIRE(**ch.recv() == static_cast<int>(i));
+	}
+	auto ch_new_c = test_new_count.load() - new_c;
+	rua::log("chan<int> allocs:", ch_new_c, "/", n);
+	REQUIRE(ch_new_c == 0);
+}
+
+TEST_CASE("handoff without allocation") {
+	static constexpr size_t n = 10000;
+
+	static rua::chan<int> ping, pong;
+
+	rua::thread([]() {
+		for (;;) {
+			auto i = **ping.recv();
+			if (i < 0) {
+				break;
+			}
+			pong.send(i);
+		}
+	});
+
+	// warm up the per-thread caches, the blocks of the queues keep flowing
+	// between the two threads until both sides have enough spares
+	for (int i = 0; i < 20000; ++i) {
+		ping.send(i);
+		**pong.recv();
+	}
+
+	auto new_c = test_new_count.load();
+	for (size_t i = 0; i < n; ++i) {
+		ping.send(static_cast<int>(i));
+		REQUIRE(**pong.recv() == static_cast<int>(i));
+	}
+	auto ch_new_c = test_new_count.load() - new_c;
+	rua::log("chan<int> send->recv allocs:", ch_new_c, "/", n);
+	REQUIRE(ch_new_c < n / 100);
+
+	ping.send(-1);
+}
+
+TEST_CASE("move_only_function") {
+	std::unique_ptr<int> up(new int(1));
+	auto p = up.get();
+
+	auto new_c = test_new_count.load();
+	rua::move_only_function<int(int)> f(
+		[p](int n) -> int { return *p + n; });
+	REQUIRE(test_new_count.load() == new_c);
+	REQUIRE(f(1) == 2);
+
+	auto f2 = std::move(f);
+	REQUIRE(!f);
+	REQUIRE(f2(2) == 3);
+
+	struct big_t {
+		size_t n[8];
+	};
+	big_t big{};
+	big.n[7] = 7;
+	new_c = test_new_count.load();
+	rua::move_only_function<size_t()> f3([big]() { return big.n[7]; });
+	REQUIRE(test_new_count.load() == new_c + 1);
+	REQUIRE(f3() == 7);
+
+	rua::move_only_function<size_t(), sizeof(big_t)> f4(
+		[big]() { return big.n[7]; });
+	REQUIRE(test_new_count.load() == new_c + 1);
+	REQUIRE(f4() == 7);
+
+	auto mo_up = rua::make_move_only(std::move(up));
+	rua::move_only_function<int()> f5([mo_up]() { return *mo_up.value(); });
+	REQUIRE(f5() == 1);
+
+	f5 = nullptr;
+	REQUIRE(!f5);
+
+	static constexpr size_t n = 10000;
+
+	for (size_t i = 0; i < 1000; ++i) {
+		**rua::parallel([i]() -> size_t { return i; });
+	}
+
+	new_c = test_new_count.load();
+	for (size_t i = 0; i < n; ++i) {
+		REQUIRE(**rua::parallel([i]() -> size_t { return i; }) == i);
+	}
+	auto par_new_c = test_new_count.load() - new_c;
+	rua::log("parallel() allocs:", par_new_c, "/", n);
+	REQUIRE(par_new_c < n / 100);
+}
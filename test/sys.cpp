@@ -0,0 +1,197 @@
+#include <rua/process.hpp>
+#include <rua/sys/reactor.hpp>
+#include <rua/sys/stream.hpp>
+#include <rua/sys/wait.hpp>
+#include <rua/thread.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+#ifdef RUA_LINUX
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+TEST_CASE("read and write pipes on reactor") {
+	static const size_t num = 500;
+
+	std::vector<rua::sys_stream> rs, ws;
+	for (size_t i = 0; i < num; ++i) {
+		int fds[2];
+		REQUIRE(::pipe(fds) == 0);
+		rs.emplace_back(fds[0]);
+		ws.emplace_back(fds[1]);
+	}
+
+	std::vector<std::string> bufs(num, std::string(16, '\0'));
+	std::vector<rua::future<ssize_t>> rds;
+	for (size_t i = 0; i < num; ++i) {
+		rds.emplace_back(rs[i].async_read(rua::as_bytes(bufs[i])));
+	}
+
+	std::vector<std::string> msgs;
+	for (size_t i = 0; i < num; ++i) {
+		msgs.emplace_back(std::to_string(i));
+	}
+	*rua::parallel([&ws, &msgs]() {
+		for (size_t i = 0; i < num; ++i) {
+			auto n = **ws[i].async_write(rua::as_bytes(msgs[i]));
+			CHECK(n == static_cast<ssize_t>(msgs[i].size()));
+		}
+	});
+
+	for (size_t i = 0; i < num; ++i) {
+		auto n = **std::move(rds[i]);
+		REQUIRE(n == static_cast<ssize_t>(msgs[i].size()));
+		REQUIRE(bufs[i].substr(0, n) == msgs[i]);
+	}
+
+	// Blocking read() and write() keep working on the attached streams.
+	REQUIRE(ws[0].write(rua::as_bytes(msgs[1])) == 1);
+	char c;
+	REQUIRE(rs[0].read(rua::as_bytes(c)) == 1);
+	REQUIRE(c == '1');
+
+	// So do the duplicates, which share the non-blocking mode.
+	auto r0 = rs[0].dup();
+	auto dup_rd = rua::parallel([&r0]() -> ssize_t {
+		char c;
+		return r0.read(rua::as_bytes(c));
+	});
+	rua::sleep(50);
+	REQUIRE(!dup_rd.await_ready());
+	REQUIRE(ws[0].write(rua::as_bytes(msgs[2])) == 1);
+	REQUIRE(**std::move(dup_rd) == 1);
+
+	// Closing fails the pending operation.
+	auto rd = rs[1].async_read(rua::as_bytes(c));
+	rs[1].close();
+	REQUIRE(**std::move(rd) == -EBADF);
+
+	ws[2].close();
+	REQUIRE(**rs[2].async_read(rua::as_bytes(c)) == 0);
+
+	// The failures carry their errno, also when the fd cannot be attached.
+	REQUIRE(**ws[3].async_read(rua::as_bytes(c)) == -EBADF);
+	rua::sys_stream dir(::open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	REQUIRE(dir);
+	REQUIRE(**dir.async_read(rua::as_bytes(c)) == -EISDIR);
+}
+
+TEST_CASE("block on attached pipes in parallel") {
+	// Keeps every worker of the default_executor() blocked at once.
+	static const size_t num = rua::default_executor().size();
+
+	static std::vector<rua::sys_stream> rs, ws;
+	for (size_t i = 0; i < num; ++i) {
+		int fds[2];
+		REQUIRE(::pipe(fds) == 0);
+		rs.emplace_back(fds[0]);
+		ws.emplace_back(fds[1]);
+
+		// Attaches the read end.
+		char c = 'a';
+		REQUIRE(ws[i].write(rua::as_bytes(c)) == 1);
+		REQUIRE(**rs[i].async_read(rua::as_bytes(c)) == 1);
+	}
+
+	std::vector<rua::future<ssize_t>> rds;
+	for (size_t i = 0; i < num; ++i) {
+		rds.emplace_back(rua::parallel([i]() -> ssize_t {
+			char c;
+			return rs[i].read(rua::as_bytes(c));
+		}));
+	}
+	rua::sleep(50);
+	for (size_t i = 0; i < num; ++i) {
+		char c = 'b';
+		REQUIRE(ws[i].write(rua::as_bytes(c)) == 1);
+	}
+	for (auto &rd : rds) {
+		REQUIRE(**rd == 1);
+	}
+
+	rs.clear();
+	ws.clear();
+}
+
+TEST_CASE("wait for eventfds and child processes on reactor") {
+	static const size_t num = 200;
+
+	std::vector<int> evfds;
+	std::vector<rua::future<>> evfd_futs;
+	for (size_t i = 0; i < num; ++i) {
+		auto evfd = eventfd(0, EFD_CLOEXEC);
+		REQUIRE(evfd >= 0);
+		evfds.emplace_back(evfd);
+		evfd_futs.emplace_back(rua::sys_wait(evfd));
+	}
+	for (auto &fut : evfd_futs) {
+		REQUIRE(!fut.await_ready());
+	}
+	for (auto evfd : evfds) {
+		uint64_t v = 1;
+		REQUIRE(::write(evfd, &v, sizeof(v)) == sizeof(v));
+	}
+	for (auto &fut : evfd_futs) {
+		REQUIRE(*fut);
+	}
+
+	// Ready already.
+	auto ready = rua::sys_wait(evfds.front());
+	REQUIRE(ready.await_ready());
+	REQUIRE(*ready);
+
+	// An fd can only be waited for once at a time.
+	auto evfd = eventfd(0, EFD_CLOEXEC);
+	REQUIRE(evfd >= 0);
+	auto first = rua::sys_wait(evfd);
+	auto second = rua::sys_wait(evfd);
+	REQUIRE(second.await_ready());
+	REQUIRE(!*second);
+	uint64_t v = 1;
+	REQUIRE(::write(evfd, &v, sizeof(v)) == sizeof(v));
+	REQUIRE(*first);
+	::close(evfd);
+
+	for (auto evfd : evfds) {
+		::close(evfd);
+	}
+
+	std::vector<rua::future<int>> proc_futs;
+	for (size_t i = 0; i < num / 4; ++i) {
+		auto pid = ::fork();
+		REQUIRE(pid >= 0);
+		if (!pid) {
+			::usleep(20000);
+			::_exit(static_cast<int>(i));
+		}
+		proc_futs.emplace_back(rua::make_awaiter(rua::process(pid)));
+	}
+	for (size_t i = 0; i < proc_futs.size(); ++i) {
+		auto ec = *proc_futs[i];
+		REQUIRE(ec);
+		REQUIRE(*ec == static_cast<int>(i));
+	}
+
+	// Exited already.
+	auto pid = ::fork();
+	REQUIRE(pid >= 0);
+	if (!pid) {
+		::_exit(7);
+	}
+	siginfo_t info;
+	REQUIRE(::waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOWAIT) == 0);
+	auto ec = *rua::make_awaiter(rua::process(pid));
+	REQUIRE(ec);
+	REQUIRE(*ec == 7);
+	REQUIRE(::waitpid(pid, nullptr, WNOHANG) < 0);
+}
+
+#endif
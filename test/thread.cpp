@@ -1,10 +1,15 @@
+#include <rua/conc/when.hpp>
+#include <rua/lockfree_queue.hpp>
 #include <rua/thread.hpp>
 #include <rua/time.hpp>
 
 #include <doctest/doctest.h>
 
 #include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 TEST_CASE("thread") {
 	static std::string r;
@@ -48,6 +53,34 @@ TEST_CASE("reset waker when woke") {
 	CHECK(ela < 500);
 }
 
+TEST_CASE("ignore stale unpark") {
+	static rua::parker pkr;
+
+	auto ticket = pkr.prepare();
+	rua::thread([=]() {
+		rua::sleep(200);
+		pkr.unpark(ticket);
+	});
+	auto t = rua::tick();
+	CHECK(pkr.park(ticket));
+	CHECK((rua::tick() - t).milliseconds() > 100);
+	pkr.finish(ticket);
+
+	ticket = pkr.prepare();
+	t = rua::tick();
+	CHECK(!pkr.park(ticket, 200));
+	CHECK((rua::tick() - t).milliseconds() > 100);
+	pkr.finish(ticket);
+
+	auto stale_ticket = ticket;
+	ticket = pkr.prepare();
+	pkr.unpark(stale_ticket);
+	CHECK(!pkr.park(ticket, 100));
+	pkr.unpark(ticket);
+	CHECK(pkr.park(ticket, 100));
+	pkr.finish(ticket);
+}
+
 TEST_CASE("use chan on thread") {
 	static rua::chan<std::string> ch;
 
@@ -96,3 +129,552 @@ TEST_CASE("use chan on multi-thread") {
 	}
 	REQUIRE(i == 200);
 }
+
+TEST_CASE("use chan in batches") {
+	static rua::chan<int> ch;
+
+	auto r1 = ch.recv();
+	auto r2 = ch.recv();
+	REQUIRE(!r1.await_ready());
+
+	std::vector<int> vals;
+	for (int i = 0; i < 100; ++i) {
+		vals.emplace_back(i);
+	}
+	REQUIRE(ch.send_many(vals) == 2);
+	REQUIRE(**r1 == 0);
+	REQUIRE(**r2 == 1);
+
+	std::vector<int> out;
+	REQUIRE(ch.try_recv_many(std::back_inserter(out), 40) == 40);
+	REQUIRE(ch.try_recv_many(std::back_inserter(out), 100) == 58);
+	REQUIRE(ch.try_recv_many(std::back_inserter(out), 100) == 0);
+	for (int i = 0; i < 98; ++i) {
+		REQUIRE(out[i] == i + 2);
+	}
+
+	rua::chan<std::string> str_ch;
+	auto str_r = str_ch.recv();
+	std::vector<std::string> strs{"a", "b"};
+	REQUIRE(str_ch.send_many(strs) == 1);
+	REQUIRE(strs[0] == "a");
+	REQUIRE(strs[1] == "b");
+	const std::vector<std::string> const_strs{"c"};
+	REQUIRE(str_ch.send_many(const_strs) == 0);
+	REQUIRE(str_ch.send_many(std::move(strs)) == 0);
+	REQUIRE(strs[0].empty());
+	REQUIRE(**str_r == "a");
+	REQUIRE(*str_ch.try_recv() == "b");
+	REQUIRE(*str_ch.try_recv() == "c");
+	REQUIRE(*str_ch.try_recv() == "a");
+	REQUIRE(*str_ch.try_recv() == "b");
+
+	static const int n = 10000;
+	static rua::chan<bool> done;
+
+	for (int t = 0; t < 4; ++t) {
+		rua::thread([]() {
+			std::vector<int> batch;
+			for (int i = 1; i <= n; ++i) {
+				batch.emplace_back(i);
+				if (batch.size() == 100) {
+					ch.send_many(batch);
+					batch.clear();
+				}
+			}
+			done.send(true);
+		});
+	}
+	long long sum = 0;
+	int c = 0;
+	while (c < n * 4) {
+		out.clear();
+		auto k = ch.try_recv_many(std::back_inserter(out), 64);
+		if (!k) {
+			out.emplace_back(**ch.recv());
+			k = 1;
+		}
+		for (auto v : out) {
+			sum += v;
+		}
+		c += static_cast<int>(k);
+	}
+	for (int t = 0; t < 4; ++t) {
+		*done.recv();
+	}
+	REQUIRE(sum == 4ll * n * (n + 1) / 2);
+	REQUIRE(!ch.try_recv());
+}
+
+TEST_CASE("use bounded_chan on thread") {
+	static rua::bounded_chan<int> ch(2);
+
+	REQUIRE(ch.try_send(1));
+	REQUIRE(*ch.send(2));
+	REQUIRE(!ch.try_send(3));
+
+	auto sent = ch.send(3);
+	REQUIRE(!sent.await_ready());
+
+	REQUIRE(**ch.recv() == 1);
+	REQUIRE(sent.await_ready());
+	REQUIRE(*ch.try_recv() == 2);
+	REQUIRE(*ch.try_recv() == 3);
+	REQUIRE(!ch.try_recv());
+
+	rua::thread([]() {
+		for (int i = 0; i < 100; ++i) {
+			*ch.send(i);
+		}
+	});
+
+	for (int i = 0; i < 100; ++i) {
+		REQUIRE(**ch.recv() == i);
+	}
+}
+
+TEST_CASE("use lockfree_queue on multi-thread") {
+	static rua::lockfree_queue<int> q;
+	static std::atomic<int> sum(0);
+	static rua::chan<bool> done;
+
+	for (int t = 0; t < 4; ++t) {
+		rua::thread([]() {
+			for (int i = 1; i <= 1000; ++i) {
+				q.emplace_back(i);
+			}
+			done.send(true);
+		});
+	}
+	for (int t = 0; t < 4; ++t) {
+		rua::thread([]() {
+			int n = 0;
+			while (n < 1000) {
+				auto val_opt = q.pop_front();
+				if (!val_opt) {
+					std::this_thread::yield();
+					continue;
+				}
+				sum += *val_opt;
+				++n;
+			}
+			done.send(true);
+		});
+	}
+	for (int t = 0; t < 8; ++t) {
+		**done.recv();
+	}
+	REQUIRE(sum.load() == 4 * 500500);
+	REQUIRE(q.empty());
+
+	rua::bounded_lockfree_queue<int> bq(3);
+	REQUIRE(bq.capacity() == 4);
+	for (int i = 0; i < 4; ++i) {
+		REQUIRE(bq.emplace_back(i));
+	}
+	REQUIRE(!bq.emplace_back(4));
+	for (int i = 0; i < 4; ++i) {
+		REQUIRE(*bq.pop_front() == i);
+	}
+	REQUIRE(!bq.pop_front());
+}
+
+TEST_CASE("use thread_var and spare_thread_word_var") {
+	static std::atomic<size_t> num_dtor(0);
+
+	rua::thread_var<std::string> a;
+	REQUIRE(!a.has_value());
+	auto &a_val = a.emplace("main");
+
+	// Grows the slots of the thread, a_val must stay valid.
+	std::vector<std::unique_ptr<rua::thread_var<std::string>>> others;
+	for (int i = 0; i < 100; ++i) {
+		others.emplace_back(new rua::thread_var<std::string>);
+		others.back()->emplace(std::to_string(i));
+	}
+	REQUIRE(a_val == "main");
+
+	rua::spare_thread_word_var wv([](rua::any_word) { ++num_dtor; });
+	wv.set(1);
+
+	static rua::thread_var<std::string> *a_ptr;
+	static rua::spare_thread_word_var *wv_ptr;
+	a_ptr = &a;
+	wv_ptr = &wv;
+
+	*rua::thread([]() {
+		CHECK(!a_ptr->has_value());
+		a_ptr->emplace("sub");
+		CHECK(a_ptr->value() == "sub");
+
+		CHECK(!wv_ptr->get());
+		wv_ptr->set(2);
+		CHECK(wv_ptr->get().value() == 2);
+	});
+	REQUIRE(num_dtor == 1);
+
+	REQUIRE(a.value() == "main");
+	REQUIRE(others[99]->value() == "99");
+	REQUIRE(wv.get().value() == 1);
+
+	a.reset();
+	REQUIRE(!a.has_value());
+	wv.reset();
+	REQUIRE(num_dtor == 2);
+	REQUIRE(!wv.get());
+
+	// The value left by a destroyed var is not seen by the next owner of its
+	// index, and is destructed by its own dtor when the slot is set again.
+	static std::atomic<size_t> old_val(0), num_new_dtor(0);
+	std::unique_ptr<rua::spare_thread_word_var> old_wv(
+		new rua::spare_thread_word_var(
+			[](rua::any_word val) { old_val = val.value(); }));
+	old_wv->set(5);
+	auto ix = old_wv->native_handle();
+	old_wv.reset();
+
+	rua::spare_thread_word_var new_wv([](rua::any_word) { ++num_new_dtor; });
+	REQUIRE(new_wv.native_handle() == ix);
+	REQUIRE(!new_wv.get());
+	new_wv.set(6);
+	REQUIRE(old_val == 5);
+	REQUIRE(new_wv.get().value() == 6);
+	new_wv.reset();
+	REQUIRE(num_new_dtor == 1);
+	REQUIRE(old_val == 5);
+}
+
+TEST_CASE("run tasks on executor") {
+	static std::atomic<size_t> n(0);
+
+	rua::executor ex(2);
+	REQUIRE(ex.size() == 2);
+
+	static rua::executor *ex_ptr;
+	ex_ptr = &ex;
+
+	for (int i = 0; i < 1000; ++i) {
+		REQUIRE(ex.post([]() {
+			++n;
+			ex_ptr->post([]() { ++n; });
+		}));
+	}
+	ex.shutdown();
+	REQUIRE(n.load() == 2000);
+
+	REQUIRE(!ex.post([]() { ++n; }));
+	REQUIRE(n.load() == 2000);
+
+	for (int i = 0; i < 100; ++i) {
+		REQUIRE(**rua::parallel([i]() -> int { return i * 2; }) == i * 2);
+	}
+}
+
+TEST_CASE("join futures with when_all and when_any") {
+	std::vector<rua::future<int>> futs;
+	for (int i = 0; i < 1000; ++i) {
+		if (i % 3) {
+			futs.emplace_back(rua::parallel([i]() -> int { return i * 2; }));
+		} else {
+			futs.emplace_back(i * 2);
+		}
+	}
+	auto rets = *rua::when_all(std::move(futs));
+	REQUIRE(rets);
+	REQUIRE(rets->size() == 1000);
+	for (int i = 0; i < 1000; ++i) {
+		REQUIRE((*rets)[i]);
+		REQUIRE(*(*rets)[i] == i * 2);
+	}
+
+	futs.clear();
+	futs.emplace_back(1);
+	futs.emplace_back(2);
+	REQUIRE(rua::when_all(std::move(futs)).await_ready());
+
+	futs.clear();
+	REQUIRE(!*rua::when_any(std::move(futs)));
+
+	for (int i = 0; i < 100; ++i) {
+		std::vector<rua::promise<int> *> prms;
+		for (int j = 0; j < 5; ++j) {
+			if (j == 3) {
+				futs.emplace_back(rua::parallel([j]() -> int { return j; }));
+				continue;
+			}
+			prms.emplace_back(new rua::newable_promise<int>);
+			futs.emplace_back(*prms.back());
+		}
+		auto ret = *rua::when_any(std::move(futs));
+		futs.clear();
+		REQUIRE(ret);
+		REQUIRE(ret->index == 3);
+		REQUIRE(ret->value);
+		REQUIRE(*ret->value == 3);
+
+		// The losers complete later.
+		for (auto prm : prms) {
+			prm->fulfill(0);
+		}
+	}
+
+	auto prm = new rua::newable_promise<int>;
+	futs.emplace_back(*prm);
+	futs.emplace_back(8);
+	auto ret = *rua::when_any(std::move(futs));
+	REQUIRE(ret);
+	REQUIRE(ret->index == 1);
+	REQUIRE(*ret->value == 8);
+	prm->fulfill(7);
+
+	// The losing receivers leave their chans.
+	for (int i = 0; i < 100; ++i) {
+		rua::chan<int> ch1, ch2;
+		std::vector<rua::future<int>> recvs;
+		recvs.emplace_back(ch1.recv());
+		recvs.emplace_back(ch2.recv());
+		auto any = rua::when_any(std::move(recvs));
+		REQUIRE(!any.await_ready());
+
+		ch1.send(1);
+		ch2.send(2);
+		auto any_ret = *std::move(any);
+		REQUIRE(any_ret);
+		REQUIRE(any_ret->index == 0);
+		REQUIRE(*any_ret->value == 1);
+
+		auto val = ch2.try_recv();
+		REQUIRE(val);
+		REQUIRE(*val == 2);
+		REQUIRE(!ch1.try_recv());
+	}
+}
+
+TEST_CASE("use shared_mutex and semaphore") {
+	static rua::shared_mutex smtx;
+
+	auto r1 = smtx.try_lock_shared();
+	auto r2 = smtx.try_lock_shared();
+	REQUIRE(r1);
+	REQUIRE(r2);
+	REQUIRE(!smtx.try_lock());
+
+	// A waiting writer holds back the new readers.
+	auto w = smtx.lock();
+	REQUIRE(!w.await_ready());
+	REQUIRE(!smtx.try_lock_shared());
+	auto r3 = smtx.lock_shared();
+	REQUIRE(!r3.await_ready());
+
+	r1();
+	REQUIRE(!w.await_ready());
+	r2();
+	REQUIRE(w.await_ready());
+	auto wul = **w;
+	REQUIRE(wul);
+	REQUIRE(!r3.await_ready());
+	wul();
+	REQUIRE(r3.await_ready());
+	auto rul = **r3;
+	REQUIRE(rul);
+	REQUIRE(!smtx.try_lock());
+	rul();
+	REQUIRE(smtx.try_lock());
+
+	static rua::semaphore sem(2);
+
+	auto p1 = sem.try_acquire();
+	REQUIRE(p1);
+	auto p2 = **sem.acquire();
+	REQUIRE(p2);
+	REQUIRE(!sem.try_acquire());
+	auto p3 = sem.acquire();
+	REQUIRE(!p3.await_ready());
+	p1();
+	REQUIRE(p3.await_ready());
+	auto p3_rel = **p3;
+	REQUIRE(p3_rel);
+	REQUIRE(!sem.try_acquire());
+	p3_rel();
+	REQUIRE(sem.try_acquire());
+
+	static int val = 0;
+	static std::atomic<bool> is_torn(false);
+	static rua::chan<bool> done;
+
+	for (int t = 0; t < 4; ++t) {
+		rua::thread([t]() {
+			for (int i = 0; i < 1000; ++i) {
+				if ((i + t) % 4) {
+					auto ul = **smtx.lock_shared();
+					if (val % 2) {
+						is_torn = true;
+					}
+					continue;
+				}
+				auto ul = **smtx.lock();
+				++val;
+				std::this_thread::yield();
+				++val;
+			}
+			done.send(true);
+		});
+	}
+	for (int t = 0; t < 4; ++t) {
+		*done.recv();
+	}
+	REQUIRE(val == 2000);
+	REQUIRE(!is_torn.load());
+}
+
+TEST_CASE("sleep and timeout on timer wheel") {
+	auto t = rua::tick();
+	REQUIRE(*rua::sleep_for(200));
+	auto ela = (rua::tick() - t).milliseconds();
+	CHECK(ela >= 200);
+	CHECK(ela < 500);
+
+	static rua::chan<std::string> ch;
+
+	t = rua::tick();
+	auto r = *rua::with_timeout(ch.recv(), 200);
+	REQUIRE(!r);
+	REQUIRE(r.error() == rua::err_waiting_timeout);
+	CHECK((rua::tick() - t).milliseconds() >= 200);
+
+	// The timed out receiver is dropped from the chan.
+	ch.send("ok");
+	REQUIRE(*ch.try_recv() == "ok");
+
+	t = rua::tick();
+	for (int i = 0; i < 30000; ++i) {
+		r = *rua::with_timeout(ch.recv(), 0);
+		REQUIRE(!r);
+	}
+	CHECK((rua::tick() - t).milliseconds() < 1000);
+	for (int i = 0; i < 20; ++i) {
+		r = *rua::with_timeout(ch.recv(), 1);
+		REQUIRE(!r);
+	}
+	ch.send("ok");
+	REQUIRE(*ch.try_recv() == "ok");
+
+	rua::thread([]() {
+		rua::sleep(100);
+		ch.send("ok");
+	});
+	r = *rua::with_timeout(ch.recv(), 10000);
+	REQUIRE(r);
+	REQUIRE(*r == "ok");
+
+	static std::atomic<size_t> n(0);
+
+	rua::timer tmr;
+	rua::default_timer_wheel().schedule(tmr, 100, []() { ++n; });
+	REQUIRE(tmr.is_pending());
+	REQUIRE(tmr.cancel());
+	REQUIRE(!tmr.is_pending());
+	REQUIRE(!tmr.cancel());
+
+	static const size_t num = 100000;
+	std::unique_ptr<rua::timer[]> tmrs(new rua::timer[num]);
+	for (size_t i = 0; i < num; ++i) {
+		rua::default_timer_wheel().schedule(
+			tmrs[i], static_cast<int64_t>(i % 300), []() { ++n; });
+	}
+	size_t cancelled = 0;
+	for (size_t i = 0; i < num; i += 2) {
+		if (tmrs[i].cancel()) {
+			++cancelled;
+		}
+	}
+	REQUIRE(cancelled);
+	*rua::sleep_for(500);
+	REQUIRE(n.load() + cancelled == num);
+}
+
+TEST_CASE("select chans") {
+	static rua::chan<int> ch1, ch2;
+
+	ch2.send(2);
+	auto r = **rua::select({&ch1, &ch2});
+	REQUIRE(r.index == 1);
+	REQUIRE(r.value == 2);
+
+	rua::thread([]() {
+		rua::sleep(100);
+		ch1.send(1);
+	});
+	r = **rua::select({&ch1, &ch2});
+	REQUIRE(r.index == 0);
+	REQUIRE(r.value == 1);
+
+	// The losing waiter is dropped from ch2.
+	ch2.send(3);
+	REQUIRE(*ch2.try_recv() == 3);
+
+	auto t = rua::tick();
+	auto r_exp = *rua::select({&ch1, &ch2}, 100);
+	REQUIRE(!r_exp);
+	REQUIRE(r_exp.error() == rua::err_waiting_timeout);
+	CHECK((rua::tick() - t).milliseconds() >= 100);
+
+	ch1.send(4);
+	REQUIRE(*ch1.try_recv() == 4);
+
+	static const int n = 10000;
+	static rua::chan<bool> done;
+
+	for (auto ch : {&ch1, &ch2}) {
+		rua::thread([ch]() {
+			for (int i = 1; i <= n; ++i) {
+				ch->send(i);
+			}
+			done.send(true);
+		});
+	}
+	int expected_sum = 0;
+	for (int i = 0; i < n * 2; ++i) {
+		r = **rua::select({&ch1, &ch2});
+		expected_sum += r.value;
+	}
+	*done.recv();
+	*done.recv();
+	REQUIRE(expected_sum == n * (n + 1));
+	REQUIRE(!ch1.try_recv());
+	REQUIRE(!ch2.try_recv());
+
+	// The losing waiters do not pile up in ch1.
+	for (int i = 0; i < 200000; ++i) {
+		auto fut = rua::select({&ch1, &ch2});
+		ch2.send(i);
+		REQUIRE((*fut)->value == i);
+	}
+	ch1.send(42);
+	REQUIRE(*ch1.try_recv() == 42);
+}
+
+#ifdef __cpp_lib_coroutine
+
+TEST_CASE("co_await chan and mutex") {
+	static rua::chan<int> ch;
+	static rua::mutex mtx;
+
+	auto ulk = **mtx.lock();
+
+	auto fut = ([]() -> rua::future<int> {
+		auto n = co_await ch.recv();
+		auto ulk = co_await mtx.lock();
+		co_return *n + 1;
+	})();
+	REQUIRE(!fut.await_ready());
+
+	ch.send(1);
+	REQUIRE(!fut.await_ready());
+
+	ulk();
+	REQUIRE(fut.await_ready());
+	REQUIRE(**fut == 2);
+}
+
+#endif
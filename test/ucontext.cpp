@@ -1,9 +1,15 @@
+#include <rua/fiber/stack.hpp>
 #include <rua/log.hpp>
 #include <rua/string.hpp>
+#include <rua/time.hpp>
 #include <rua/ucontext.hpp>
 
 #include <doctest/doctest.h>
 
+#ifdef __GLIBC__
+#include <ucontext.h>
+#endif
+
 static void log(rua::string_view str) {
 	static size_t log_sz = 0;
 	if (log_sz) {
@@ -89,3 +95,145 @@ TEST_CASE("ucontext") {
 
 	REQUIRE(main_uc_looping_count == 6);
 }
+
+TEST_CASE("run ucontext on pooled stacks") {
+	static rua::ucontext_t main_uc, sub_uc;
+	static size_t depth;
+
+	rua::stack_pool pool(64 * 1024, 1);
+	REQUIRE(pool.stack_size() >= 64 * 1024);
+
+	auto stack = pool.alloc();
+	REQUIRE(stack.size() == pool.stack_size());
+	auto stack_data = stack.data();
+
+	rua::get_ucontext(&sub_uc);
+	rua::make_ucontext(
+		&sub_uc,
+		[](rua::any_word param) {
+			// Touches the pages down to the bottom of the stack.
+			auto stack = param.as<rua::bytes_ref *>();
+			for (auto p = stack->data() + stack->size() - 4096;
+				 p > stack->data() + 8192;
+				 p -= 4096) {
+				*p = 1;
+				++depth;
+			}
+			rua::set_ucontext(&main_uc);
+		},
+		&stack,
+		stack);
+	rua::swap_ucontext(&main_uc, &sub_uc);
+	REQUIRE(depth > 0);
+
+	auto stack2 = pool.alloc();
+	REQUIRE(stack2.data() != stack_data);
+
+	pool.dealloc(stack);
+	pool.dealloc(stack2);
+	REQUIRE(pool.num_idle() == 2);
+
+	// The stack sunk below the hot one is discarded and reads zeros again.
+	auto hot = pool.alloc();
+	REQUIRE(hot.data() == stack2.data());
+	auto cold = pool.alloc();
+	REQUIRE(cold.data() == stack_data);
+	CHECK(cold[cold.size() - 4096] == 0);
+
+	pool.dealloc(cold);
+	pool.dealloc(hot);
+	pool.trim();
+	REQUIRE(pool.num_idle() == 2);
+}
+
+#ifdef RUA_JUMP_UCONTEXT
+
+TEST_CASE("jump_ucontext") {
+	static rua::jump_ucontext_t main_juc, sub_juc;
+
+	rua::stack_pool pool(64 * 1024);
+	auto stack = pool.alloc();
+
+	rua::make_jump_ucontext(
+		&sub_juc,
+		[](rua::any_word data) {
+			for (;;) {
+				data = rua::jump_ucontext(&sub_juc, &main_juc, data.value() * 2);
+			}
+		},
+		stack);
+
+	for (size_t i = 1; i < 10; ++i) {
+		REQUIRE(
+			rua::jump_ucontext(&main_juc, &sub_juc, i).value() == i * 2);
+	}
+
+	pool.dealloc(stack);
+}
+
+#endif
+
+static const size_t bench_n = 1000000;
+
+static double ns_per_switch(rua::duration dur) {
+	return static_cast<double>(dur.nanoseconds()) / (bench_n * 2);
+}
+
+TEST_CASE("benchmark context switches") {
+	rua::stack_pool pool(64 * 1024);
+	auto stack = pool.alloc();
+
+	static rua::ucontext_t main_uc, sub_uc;
+	rua::get_ucontext(&sub_uc);
+	rua::make_ucontext(
+		&sub_uc,
+		[](rua::any_word) {
+			for (;;) {
+				rua::swap_ucontext(&sub_uc, &main_uc);
+			}
+		},
+		nullptr,
+		stack);
+	auto t = rua::tick();
+	for (size_t i = 0; i < bench_n; ++i) {
+		rua::swap_ucontext(&main_uc, &sub_uc);
+	}
+	rua::log("swap_ucontext:", ns_per_switch(rua::tick() - t), "ns/switch");
+
+#ifdef RUA_JUMP_UCONTEXT
+	static rua::jump_ucontext_t main_juc, sub_juc;
+	rua::make_jump_ucontext(
+		&sub_juc,
+		[](rua::any_word) {
+			for (;;) {
+				rua::jump_ucontext(&sub_juc, &main_juc);
+			}
+		},
+		stack);
+	t = rua::tick();
+	for (size_t i = 0; i < bench_n; ++i) {
+		rua::jump_ucontext(&main_juc, &sub_juc);
+	}
+	rua::log("jump_ucontext:", ns_per_switch(rua::tick() - t), "ns/switch");
+#endif
+
+#ifdef __GLIBC__
+	static ::ucontext_t main_gctx, sub_gctx;
+	REQUIRE(::getcontext(&sub_gctx) == 0);
+	sub_gctx.uc_link = nullptr;
+	sub_gctx.uc_stack.ss_sp = stack.data();
+	sub_gctx.uc_stack.ss_size = stack.size();
+	::makecontext(&sub_gctx, []() {
+		for (;;) {
+			::swapcontext(&sub_gctx, &main_gctx);
+		}
+	}, 0);
+	t = rua::tick();
+	for (size_t i = 0; i < bench_n; ++i) {
+		::swapcontext(&main_gctx, &sub_gctx);
+	}
+	rua::log("glibc swapcontext:", ns_per_switch(rua::tick() - t), "ns/switch");
+#endif
+
+	pool.dealloc(stack);
+}